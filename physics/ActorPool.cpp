@@ -0,0 +1,183 @@
+#include "PhysicsUtil.h"
+#include "Callbacks.h"
+#include "ActorPool.h"
+
+using namespace osgPhysics;
+using namespace physx;
+
+ActorPool::BodyKey::BodyKey(const PxGeometry& geom, double d, PxMaterial* mtl)
+    : geometry(geom), material(mtl), density(d)
+{
+}
+
+bool ActorPool::BodyKey::operator<(const BodyKey& rhs) const
+{
+    if (geometry < rhs.geometry) return true;
+    if (rhs.geometry < geometry) return false;
+    if (material != rhs.material) return material < rhs.material;
+    return density < rhs.density;
+}
+
+ActorPool::ActorPool(const std::string& sceneName)
+    : _sceneName(sceneName), _growSize(16), _numActiveBodies(0)
+{
+    _root = new osg::Group;
+}
+
+ActorPool::~ActorPool()
+{
+    clear();
+}
+
+unsigned int ActorPool::reserve(const PxGeometry& geom, double density, PxMaterial* mtl, unsigned int numBodies)
+{
+    BodyType* type = getOrCreateType(geom, density, mtl);
+    if (!type) return 0;
+
+    unsigned int numFree = type->freeBodies.size();
+    if (numFree < numBodies && grow(type, density, mtl, numBodies - numFree))
+        numFree = numBodies;
+    return numFree;
+}
+
+PxRigidDynamic* ActorPool::acquire(const PxGeometry& geom, double density, PxMaterial* mtl,
+                                   const PxTransform& pose, osg::MatrixTransform** node)
+{
+    BodyType* type = getOrCreateType(geom, density, mtl);
+    if (!type) return NULL;
+    if (type->freeBodies.empty() && !grow(type, density, mtl, _growSize)) return NULL;
+
+    PooledBody& body = _bodies[type->freeBodies.back()];
+    type->freeBodies.pop_back();
+    body.active = true; _numActiveBodies++;
+
+    // Velocities can only be set after simulation is enabled
+    PxRigidDynamic* actor = body.actor;
+    actor->setActorFlag(PxActorFlag::eDISABLE_SIMULATION, false);
+    actor->setGlobalPose(pose);
+    actor->setLinearVelocity(PxVec3(0.0f, 0.0f, 0.0f));
+    actor->setAngularVelocity(PxVec3(0.0f, 0.0f, 0.0f));
+    actor->wakeUp();
+
+    body.node->setMatrix(toMatrix(pose));
+    body.node->setNodeMask(0xffffffff);
+    if (_updater.valid()) _updater->resetActorNode(actor);
+    if (node) *node = body.node.get();
+    return actor;
+}
+
+bool ActorPool::release(PxRigidActor* actor)
+{
+    std::map<PxRigidActor*, unsigned int>::iterator itr = _bodyIndices.find(actor);
+    if (itr == _bodyIndices.end()) return false;
+
+    PooledBody& body = _bodies[itr->second];
+    if (!body.active) return false;
+    body.actor->setActorFlag(PxActorFlag::eDISABLE_SIMULATION, true);
+    body.node->setNodeMask(0);
+    body.active = false; _numActiveBodies--;
+    body.type->freeBodies.push_back(itr->second);  // capacity reserved when growing
+    return true;
+}
+
+void ActorPool::clear()
+{
+    _batch.clear();
+    for (unsigned int i = 0; i < _bodies.size(); ++i)
+    {
+        PooledBody& body = _bodies[i];
+        if (_updater.valid()) _updater->removeActorNode(body.actor);
+        _batch.push_back(body.actor);
+    }
+
+    if (!_batch.empty()) Engine::instance()->removeActors(&_batch[0], _batch.size());
+    for (unsigned int i = 0; i < _bodies.size(); ++i) _bodies[i].actor->release();
+    _root->removeChildren(0, _root->getNumChildren());
+    _bodies.clear(); _bodyIndices.clear(); _types.clear(); _batch.clear();
+    _numActiveBodies = 0;
+}
+
+ActorPool::BodyType* ActorPool::getOrCreateType(const PxGeometry& geom, double density, PxMaterial* mtl)
+{
+    BodyKey key(geom, density, mtl);
+    BodyTypeMap::iterator itr = _types.find(key);
+    if (itr != _types.end()) return &(itr->second);
+
+    if (density <= 0.0)
+    {
+        OSG_WARN << "[ActorPool] Density must be positive for pooled dynamic bodies" << std::endl;
+        return NULL;
+    }
+
+    switch (key.geometry.type)
+    {
+    case PxGeometryType::eSPHERE: case PxGeometryType::eCAPSULE:
+    case PxGeometryType::eBOX: case PxGeometryType::eCONVEXMESH:
+        break;
+    default:
+        OSG_WARN << "[ActorPool] Unsupported geometry type " << key.geometry.type << std::endl;
+        return NULL;
+    }
+
+    BodyType& type = _types[key];
+    type.geometry.storeAny(geom);
+    return &type;
+}
+
+bool ActorPool::grow(BodyType* type, double density, PxMaterial* mtl, unsigned int numBodies)
+{
+    unsigned int sceneId = Engine::instance()->getSceneId(_sceneName);
+    if (!Engine::instance()->getScene(sceneId))
+    {
+        OSG_WARN << "[ActorPool] Scene " << _sceneName << " not found" << std::endl;
+        return false;
+    }
+
+    _batch.clear();
+    unsigned int start = _bodies.size();
+    for (unsigned int i = 0; i < numBodies; ++i)
+    {
+        PxRigidActor* rigid = createActor(type->geometry.any(), density, mtl);
+        PxRigidDynamic* actor = rigid ? rigid->is<PxRigidDynamic>() : NULL;
+        if (!actor)
+        {
+            if (rigid) rigid->release();
+            break;
+        }
+
+        // Simulation of free bodies is disabled, they are still added so that acquiring costs nothing
+        actor->setActorFlag(PxActorFlag::eDISABLE_SIMULATION, true);
+        _batch.push_back(actor);
+
+        PooledBody body;
+        body.actor = actor;
+        body.node = new osg::MatrixTransform;
+        body.node->setNodeMask(0);
+        body.type = type;
+        body.active = false;
+
+        if (!type->shape) type->shape = GeometryDrawableCache::instance()->getOrCreate(type->geometry.any());
+        if (type->shape.valid()) body.node->addChild(type->shape.get());
+        _root->addChild(body.node.get());
+
+        _bodyIndices[actor] = _bodies.size();
+        _bodies.push_back(body);
+    }
+    if (_batch.empty()) return false;
+
+    Engine::instance()->addActors(sceneId, &_batch[0], _batch.size());
+    for (unsigned int i = start; i < _bodies.size(); ++i)
+    {
+        PooledBody& body = _bodies[i];
+        if (_updater.valid()) _updater->addActorNode(body.actor, body.node.get());
+        else body.node->addUpdateCallback(new UpdateActorCallback(body.actor));
+        type->freeBodies.push_back(i);
+    }
+
+    // Reserve for all bodies of the type, so that releasing never allocates
+    unsigned int numOfType = 0;
+    for (unsigned int i = 0; i < _bodies.size(); ++i)
+    { if (_bodies[i].type == type) numOfType++; }
+    type->freeBodies.reserve(numOfType);
+    return true;
+}
@@ -0,0 +1,101 @@
+#ifndef PHYSICS_ACTORPOOL
+#define PHYSICS_ACTORPOOL
+
+#include <osg/observer_ptr>
+#include <osg/MatrixTransform>
+#include "PhysicsUtil.h"
+
+namespace osgPhysics
+{
+
+    class UpdatePhysicsSystemCallback;
+
+    /** The pooled spawner of dynamic rigid bodies, keyed by geometry, material and density. Bodies and their
+        matrix transforms are created in advance and stay in the scene and the scene graph: releasing a body
+        only disables its simulation and hides its node, and acquiring it again resets pose and velocities.
+        Sphere, box, capsule and convex mesh geometries are supported
+    */
+    class ActorPool : public osg::Referenced
+    {
+    public:
+        ActorPool(const std::string& sceneName = "");
+
+        /** Get the group of all pooled nodes, which should be added to the scene graph */
+        osg::Group* getRoot() { return _root.get(); }
+
+        /** Set the system updater to register pooled nodes with, see UpdatePhysicsSystemCallback::addActorNode().
+            Otherwise each node gets an UpdateActorCallback. Must be set before any body is created
+        */
+        void setSystemUpdater(UpdatePhysicsSystemCallback* cb) { _updater = cb; }
+        UpdatePhysicsSystemCallback* getSystemUpdater() { return _updater.get(); }
+
+        /** Set number of bodies to create when acquiring from an empty pool */
+        void setGrowSize(unsigned int n) { _growSize = n > 0 ? n : 1; }
+        unsigned int getGrowSize() const { return _growSize; }
+
+        /** Pre-create bodies so that at least the number of them are free, returns number of free bodies */
+        unsigned int reserve(const physx::PxGeometry& geom, double density, physx::PxMaterial* mtl,
+                             unsigned int numBodies);
+
+        /** Get a free body and enable it at the pose with zero velocities, creating more if none is free.
+            The matrix transform of the body is returned in node if not NULL
+        */
+        physx::PxRigidDynamic* acquire(const physx::PxGeometry& geom, double density, physx::PxMaterial* mtl,
+                                       const physx::PxTransform& pose, osg::MatrixTransform** node = NULL);
+
+        /** Return an acquired body to the pool, disabling its simulation and hiding its node */
+        bool release(physx::PxRigidActor* actor);
+
+        unsigned int getNumBodies() const { return _bodies.size(); }
+        unsigned int getNumActiveBodies() const { return _numActiveBodies; }
+
+        /** Remove all bodies from the scene and the scene graph and release them */
+        void clear();
+
+    protected:
+        virtual ~ActorPool();
+
+        /** Identity of bodies which could replace each other */
+        struct BodyKey
+        {
+            GeometryKey geometry;
+            physx::PxMaterial* material;
+            double density;
+
+            BodyKey(const physx::PxGeometry& geom, double d, physx::PxMaterial* mtl);
+            bool operator<(const BodyKey& rhs) const;
+        };
+
+        struct BodyType
+        {
+            physx::PxGeometryHolder geometry;
+            osg::ref_ptr<osg::Geode> shape;  // shared by nodes of all bodies, see GeometryDrawableCache
+            std::vector<unsigned int> freeBodies;
+        };
+
+        struct PooledBody
+        {
+            physx::PxRigidDynamic* actor;
+            osg::ref_ptr<osg::MatrixTransform> node;
+            BodyType* type;
+            bool active;
+        };
+
+        BodyType* getOrCreateType(const physx::PxGeometry& geom, double density, physx::PxMaterial* mtl);
+        bool grow(BodyType* type, double density, physx::PxMaterial* mtl, unsigned int numBodies);
+
+        typedef std::map<BodyKey, BodyType> BodyTypeMap;
+        BodyTypeMap _types;
+        std::vector<PooledBody> _bodies;
+        std::map<physx::PxRigidActor*, unsigned int> _bodyIndices;
+
+        osg::ref_ptr<osg::Group> _root;
+        osg::observer_ptr<UpdatePhysicsSystemCallback> _updater;
+        std::vector<physx::PxActor*> _batch;
+        std::string _sceneName;
+        unsigned int _growSize, _numActiveBodies;
+    };
+
+}
+
+#endif
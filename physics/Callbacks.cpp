@@ -5,22 +5,171 @@
 #include "Vehicle.h"
 #include "VehicleManager.h"
 #include "PhysicsUtil.h"
+#include "Profiler.h"
 #include <algorithm>
 #include <iostream>
+#include <math.h>
 
 using namespace osgPhysics;
 using namespace physx;
 
 /* UpdatePhysicsSystemCallback */
 
-void UpdatePhysicsSystemCallback::addVehicle(WheeledVehicle* vehicle)
+static void applyVehicleComponents(osg::Group* car, WheeledVehicle* vehicle, double alpha,
+                                   std::vector<osg::Matrix>& matrices)
+{
+    // Update poses of car parts, note they are all world matrices
+    const std::vector<PxTransform>& currentPoses = vehicle->getComponentPoses();
+    const std::vector<PxTransform>& previousPoses = vehicle->getPreviousComponentPoses();
+    unsigned int size = std::min<unsigned int>(car->getNumChildren(), currentPoses.size());
+    if (alpha >= 1.0 && size > 0)
+    {
+        matrices.resize(size);
+        toMatrices(&currentPoses[0], &matrices[0], size);
+    }
+
+    for (unsigned int i = 0; i < size; ++i)
+    {
+        // We must ensure all children are transforms
+        osg::MatrixTransform* component = static_cast<osg::MatrixTransform*>(car->getChild(i));
+        if (alpha < 1.0)
+            component->setMatrix(toMatrix(previousPoses[i], currentPoses[i], alpha));
+        else
+            component->setMatrix(matrices[i]);
+    }
+}
+
+void UpdatePhysicsSystemCallback::addVehicle(WheeledVehicle* vehicle, osg::Group* components)
 {
     _vehicles.push_back(vehicle);
+    _vehicleNodes.push_back(components);
     _vehicleEngines.push_back(vehicle->getDriveEngine());
     _queryResults.push_back(vehicle->getQueryResult());
     computeTotalWheels();
 }
 
+bool UpdatePhysicsSystemCallback::removeVehicle(WheeledVehicle* vehicle)
+{
+    for (unsigned int i = 0; i < _vehicles.size(); ++i)
+    {
+        if (_vehicles[i] != vehicle) continue;
+        if (_lodManager.valid()) _lodManager->removeVehicle(vehicle);
+        _vehicles.erase(_vehicles.begin() + i);
+        _vehicleNodes.erase(_vehicleNodes.begin() + i);
+        _vehicleEngines.erase(_vehicleEngines.begin() + i);
+        _queryResults.erase(_queryResults.begin() + i);
+        computeTotalWheels();
+        return true;
+    }
+    return false;
+}
+
+void UpdatePhysicsSystemCallback::addCharacter(CharacterController* character, osg::MatrixTransform* node)
+{
+    if (!character) return;
+    if (character->getScene() != Engine::instance()->getScene(_sceneName))
+    {
+        OSG_WARN << "[UpdatePhysicsSystemCallback] Character is not created in scene " << _sceneName << std::endl;
+        return;
+    }
+    _characters.push_back(character);
+    _characterNodes.push_back(node);
+}
+
+bool UpdatePhysicsSystemCallback::removeCharacter(CharacterController* character)
+{
+    for (unsigned int i = 0; i < _characters.size(); ++i)
+    {
+        if (_characters[i] != character) continue;
+        if (_lodManager.valid()) _lodManager->removeCharacter(character);
+        _characters.erase(_characters.begin() + i);
+        _characterNodes.erase(_characterNodes.begin() + i);
+        return true;
+    }
+    return false;
+}
+
+void UpdatePhysicsSystemCallback::addActorNode(PxRigidActor* actor, osg::MatrixTransform* node)
+{
+    if (!actor || !node) return;
+    if (removeActorNode(actor))
+        OSG_NOTICE << "[UpdatePhysicsSystemCallback] Actor node replaced" << std::endl;
+
+    // Index + 1 is saved as actor data of the engine, so that NULL means unregistered
+    if (!Engine::instance()->setActorData(actor, (void*)(size_t)(_actorNodes.size() + 1)))
+    {
+        OSG_WARN << "[UpdatePhysicsSystemCallback] Actor must be added to the engine before its node" << std::endl;
+        return;
+    }
+
+    ActorNode entry;
+    entry.actor = actor;
+    entry.node = node;
+    entry.currentPose = actor->getGlobalPose();
+    entry.previousPose = entry.currentPose;
+    node->setMatrix(toMatrix(entry.currentPose));
+
+    _actorNodes.push_back(entry);
+}
+
+static void replaceIndex(std::vector<unsigned int>& indices, unsigned int from, unsigned int to)
+{
+    for (unsigned int i = 0; i < indices.size();)
+    {
+        if (indices[i] == from && to == ~0u)
+        {
+            indices[i] = indices.back();
+            indices.pop_back();
+        }
+        else
+        {
+            if (indices[i] == from) indices[i] = to;
+            ++i;
+        }
+    }
+}
+
+bool UpdatePhysicsSystemCallback::removeActorNode(PxRigidActor* actor)
+{
+    Engine* engine = Engine::instance();
+    size_t index = (size_t)engine->getActorData(actor);
+    if (!index || index > _actorNodes.size() || _actorNodes[index - 1].actor != actor)
+    {
+        // The actor may be removed from the engine already, together with its data
+        index = 0;
+        for (unsigned int i = 0; i < _actorNodes.size() && actor; ++i)
+        { if (_actorNodes[i].actor == actor) { index = i + 1; break; } }
+        if (!index) return false;
+    }
+
+    // Swap-remove the entry and fix indices of the moved one
+    unsigned int removed = index - 1, last = _actorNodes.size() - 1;
+    replaceIndex(_movingActorNodes, removed, ~0u);
+    replaceIndex(_settledActorNodes, removed, ~0u);
+    if (removed != last)
+    {
+        _actorNodes[removed] = _actorNodes[last];
+        engine->setActorData(_actorNodes[removed].actor, (void*)(size_t)(removed + 1));
+        replaceIndex(_movingActorNodes, last, removed);
+        replaceIndex(_settledActorNodes, last, removed);
+    }
+    _actorNodes.pop_back();
+    engine->setActorData(actor, NULL);
+    return true;
+}
+
+bool UpdatePhysicsSystemCallback::resetActorNode(PxRigidActor* actor)
+{
+    size_t index = (size_t)Engine::instance()->getActorData(actor);
+    if (!index || index > _actorNodes.size() || _actorNodes[index - 1].actor != actor) return false;
+
+    ActorNode& entry = _actorNodes[index - 1];
+    entry.currentPose = actor->getGlobalPose();
+    entry.previousPose = entry.currentPose;
+    if (entry.node.valid()) entry.node->setMatrix(toMatrix(entry.currentPose));
+    return true;
+}
+
 void UpdatePhysicsSystemCallback::computeTotalWheels()
 {
     _numTotalWheels = 0;
@@ -30,6 +179,23 @@ void UpdatePhysicsSystemCallback::computeTotalWheels()
 
 void UpdatePhysicsSystemCallback::operator()(osg::Node* node, osg::NodeVisitor* nv)
 {
+    // Close timings of last frame, including scene graph callbacks of its update traversal.
+    // It is skipped if the application has already ended the frame itself
+    const osg::FrameStamp* frameStamp = nv ? nv->getFrameStamp() : NULL;
+    if (frameStamp)
+        Profiler::instance()->endFrameOnce(frameStamp->getFrameNumber() > 0 ? frameStamp->getFrameNumber() - 1 : 0);
+    else
+        Profiler::instance()->endFrame();
+
+    // Results of the step started at the end of last frame are required from now on. It may have been
+    // fetched already by other engine calls, so sync whenever a step was fetched since last sync
+    Engine* engine = Engine::instance();
+    if (_asyncUpdate)
+    {
+        engine->endUpdate();
+        if (engine->getNumSimulatedSteps() != _syncedSteps) syncSimulatedStep();
+    }
+
     double step = _frameTime;
     if (step <= 0.0)
     {
@@ -38,24 +204,167 @@ void UpdatePhysicsSystemCallback::operator()(osg::Node* node, osg::NodeVisitor*
         _lastSimulationTime = fs->getSimulationTime();
     }
 
-    if (_maxSimulationDelta > 0.0)
+    // Handle inputs of vehicles whose components are updated here
+    for (unsigned int i = 0; i < _vehicles.size(); ++i)
+    {
+        if (_vehicleNodes[i].valid()) _vehicles[i]->handleInputs(step);
+    }
+
+    // Move all characters in one pass, as offsets of characters are applied once per frame
+    if (_lodManager.valid())
+    {
+        // Select agents of this frame, reduced-rate characters are moved for all skipped frames at once
+        _lodManager->select(step, _vehicles, _characters, _lodSelection);
+        PxScene* scene = engine->getScene(_sceneName);
+        float interval = (float)_lodManager->getReducedRateInterval();
+        CharacterControlManager::instance()->update(step, scene, _lodSelection.characters);
+        CharacterControlManager::instance()->update(step * interval, scene, _lodSelection.reducedCharacters, interval);
+    }
+    else if (!_characters.empty())
+        CharacterControlManager::instance()->update(step, engine->getScene(_sceneName), _characters);
+
+    double asyncStep = 0.0, alpha = 1.0;
+    if (_fixedTimeStep > 0.0)
+    {
+        // Consume accumulated time in fixed steps and drop what we are unable to catch up with
+        _accumulator += step;
+        unsigned int numSteps = (unsigned int)floor(_accumulator / _fixedTimeStep);
+        if (_maxSubSteps > 0 && numSteps > _maxSubSteps) numSteps = _maxSubSteps;
+        _accumulator -= _fixedTimeStep * numSteps;
+        if (_accumulator >= _fixedTimeStep) _accumulator = fmod(_accumulator, _fixedTimeStep);
+
+        for (unsigned int i = 0; i < numSteps; ++i)
+            simulateStep(_fixedTimeStep, i + 1 == numSteps, asyncStep);
+        alpha = _accumulator / _fixedTimeStep;
+    }
+    else if (_maxSimulationDelta > 0.0)
     {
         for (; step > 0.0; step -= _maxSimulationDelta)
+            simulateStep(std::min(step, _maxSimulationDelta), step <= _maxSimulationDelta, asyncStep);
+    }
+    else
+        simulateStep(step, true, asyncStep);
+
+    // All scenes are advanced by Engine::update(), so they share the unsimulated remainder
+    Engine::SceneMap& scenes = engine->getSceneMap();
+    for (Engine::SceneMap::iterator itr = scenes.begin(); itr != scenes.end(); ++itr)
+        engine->setInterpolationFactor(itr->second, alpha);
+
+    {
+        ProfileScope profile(Profiler::TRANSFORM_SYNC);
+        if (!_actorNodes.empty()) applyActorNodes(alpha);
+        for (unsigned int i = 0; i < _vehicles.size(); ++i)
+        {
+            if (_vehicleNodes[i].valid())
+                applyVehicleComponents(_vehicleNodes[i].get(), _vehicles[i], _fixedTimeStep > 0.0 ? alpha : 1.0, _batchMatrices);
+        }
+        for (unsigned int i = 0; i < _characters.size(); ++i)
         {
-            double s = std::min(step, _maxSimulationDelta);
-            if (_vehicleEngines.size() > 0)
-                VehicleManager::instance()->update(s, _sceneName, _vehicleEngines, _queryResults, _numTotalWheels);
-            Engine::instance()->update(s);
+            if (!_characterNodes[i].valid()) continue;
+            const PxExtendedVec3& pos = _characters[i]->getPosition();
+            _characterNodes[i]->setMatrix(osg::Matrix::translate(pos.x, pos.y, pos.z));
         }
     }
-    else
+    if (node) traverse(node, nv);
+    if (asyncStep > 0.0) engine->beginUpdate(asyncStep);
+}
+
+void UpdatePhysicsSystemCallback::simulateStep(double dt, bool lastStep, double& asyncStep)
+{
+    if (_lodManager.valid())
     {
-        if (_vehicleEngines.size() > 0)
-            VehicleManager::instance()->update(step, _sceneName, _vehicleEngines, _queryResults, _numTotalWheels);
-        Engine::instance()->update(step);
+        PhysicsLODManager::Selection& s = _lodSelection;
+        if (!s.raycastVehicles.empty())
+            VehicleManager::instance()->update(dt, _sceneName, s.raycastVehicles, s.raycastResults, s.numRaycastWheels);
+        VehicleManager::instance()->updateWithoutRaycasts(dt, _sceneName, s.cachedVehicles, s.cachedResults);
+        _lodManager->updateKinematicVehicles(dt);
     }
+    else if (_vehicleEngines.size() > 0)
+        VehicleManager::instance()->update(dt, _sceneName, _vehicleEngines, _queryResults, _numTotalWheels);
+    if (_asyncUpdate && lastStep) asyncStep = dt;
+    else { Engine::instance()->update(dt); syncSimulatedStep(); }
+}
 
-    if (node) traverse(node, nv);
+void UpdatePhysicsSystemCallback::syncSimulatedStep()
+{
+    ProfileScope profile(Profiler::TRANSFORM_SYNC);
+    _syncedSteps = Engine::instance()->getNumSimulatedSteps();
+    syncActiveActors();
+    for (unsigned int i = 0; i < _vehicles.size(); ++i)
+        _vehicles[i]->updateComponentPoses();
+}
+
+void UpdatePhysicsSystemCallback::syncActiveActors()
+{
+    if (_actorNodes.empty()) return;
+
+    // Actors moved in last step but not in this one will be at rest after being applied once more
+    for (unsigned int i = 0; i < _movingActorNodes.size(); ++i)
+    {
+        ActorNode& entry = _actorNodes[_movingActorNodes[i]];
+        entry.previousPose = entry.currentPose;
+        _settledActorNodes.push_back(_movingActorNodes[i]);
+    }
+    _movingActorNodes.clear();
+
+    Engine* engine = Engine::instance();
+    PxScene* scene = engine->getScene(_sceneName);
+    if (!scene) return;
+    if (!(scene->getFlags() & PxSceneFlag::eENABLE_ACTIVE_ACTORS))
+    {
+        scene->setFlag(PxSceneFlag::eENABLE_ACTIVE_ACTORS, true);
+        return;  // will be reported from next step
+    }
+
+    PxU32 numActiveActors = 0;
+    PxActor** activeActors = scene->getActiveActors(numActiveActors);
+    for (PxU32 i = 0; i < numActiveActors; ++i)
+    {
+        size_t index = (size_t)engine->getActorData(activeActors[i]);
+        if (!index || index > _actorNodes.size()) continue;
+
+        ActorNode& entry = _actorNodes[index - 1];
+        if (entry.actor != activeActors[i]) continue;  // actor data not set by us
+        entry.currentPose = entry.actor->getGlobalPose();
+        _movingActorNodes.push_back(index - 1);
+    }
+}
+
+void UpdatePhysicsSystemCallback::applyActorNodes(double alpha)
+{
+    // Convert all unblended poses in one batch
+    bool blended = (_fixedTimeStep > 0.0 && alpha < 1.0);
+    _batchPoses.clear();
+    for (unsigned int i = 0; i < _settledActorNodes.size(); ++i)
+        _batchPoses.push_back(_actorNodes[_settledActorNodes[i]].currentPose);
+    if (!blended)
+    {
+        for (unsigned int i = 0; i < _movingActorNodes.size(); ++i)
+            _batchPoses.push_back(_actorNodes[_movingActorNodes[i]].currentPose);
+    }
+
+    _batchMatrices.resize(_batchPoses.size());
+    if (!_batchPoses.empty()) toMatrices(&_batchPoses[0], &_batchMatrices[0], _batchPoses.size());
+
+    unsigned int n = 0;
+    for (unsigned int i = 0; i < _settledActorNodes.size(); ++i, ++n)
+    {
+        ActorNode& entry = _actorNodes[_settledActorNodes[i]];
+        if (entry.node.valid()) entry.node->setMatrix(_batchMatrices[n]);
+    }
+    _settledActorNodes.clear();
+
+    for (unsigned int i = 0; i < _movingActorNodes.size(); ++i)
+    {
+        ActorNode& entry = _actorNodes[_movingActorNodes[i]];
+        if (blended)
+        {
+            if (entry.node.valid())
+                entry.node->setMatrix(toMatrix(entry.previousPose, entry.currentPose, alpha));
+        }
+        else if (entry.node.valid()) entry.node->setMatrix(_batchMatrices[n++]);
+        else n++;
+    }
 }
 
 /* UpdateActorCallback */
@@ -65,8 +374,29 @@ void UpdateActorCallback::operator()(osg::Node* node, osg::NodeVisitor* nv)
     osg::MatrixTransform* mt = (node->asTransform() ? node->asTransform()->asMatrixTransform() : NULL);
     if (mt && _actor)
     {
-        PxMat44 matrix(_actor->getGlobalPose());
-        mt->setMatrix(toMatrix(matrix));
+        if (_interpolated)
+        {
+            // Record the pose of every new step we see, and blend the last two of them
+            Engine* engine = Engine::instance();
+            unsigned int numSteps = engine->getNumSimulatedSteps();
+            if (!_hasPoses)
+            {
+                _currentPose = _actor->getGlobalPose();
+                _previousPose = _currentPose;
+                _hasPoses = true;
+            }
+            else if (numSteps != _lastNumSteps)
+            {
+                _previousPose = _currentPose;
+                _currentPose = _actor->getGlobalPose();
+            }
+            _lastNumSteps = numSteps;
+            mt->setMatrix(toMatrix(_previousPose, _currentPose, engine->getInterpolationFactor(_actor->getScene())));
+        }
+        else
+        {
+            mt->setMatrix(toMatrix(_actor->getGlobalPose()));
+        }
     }
     traverse(node, nv);
 }
@@ -103,16 +433,9 @@ void UpdateVehicleCallback::operator()(osg::Node* node, osg::NodeVisitor* nv)
     //PxMat44 carMatrix( _physicsVehicle->getActor()->getGlobalPose() );
     //car->setMatrix( toMatrix(carMatrix) );
 
-    // Update poses of car parts, note they are all world matrices
-    std::vector<PxTransform> transforms;
-    unsigned int size = _physicsVehicle->getComponentTransforms(transforms);
-    size = std::min<unsigned int>(car->getNumChildren(), size);
-    for (unsigned int i = 0; i < size; ++i)
-    {
-        // We must ensure all children are transforms
-        osg::MatrixTransform* component = static_cast<osg::MatrixTransform*>(car->getChild(i));
-        component->setMatrix(toMatrix(PxMat44(transforms[i])));
-    }
+    double alpha = _interpolated ?
+        Engine::instance()->getInterpolationFactor(_physicsVehicle->getActor()->getScene()) : 1.0;
+    applyVehicleComponents(car, _physicsVehicle, alpha, _matrices);
 
     // Handle inputs
     double step = _frameTime;
@@ -3,7 +3,8 @@
 
 #include <osg/observer_ptr>
 #include <osg/NodeCallback>
-#include "Engine.h"
+#include <osg/MatrixTransform>
+#include "PhysicsLODManager.h"
 
 namespace physx
 {
@@ -19,24 +20,54 @@ namespace osgPhysics
     class CharacterController;
     class WheeledVehicle;
 
-    /** The callback to update the entire physics system, should be applied to the root node */
+    /** The callback to update the entire physics system, should be applied to the root node.
+        It steps all scenes of the engine together (see Engine::update()), so only one should be installed,
+        otherwise scenes are advanced by each of them. The scene name only selects where vehicles, characters
+        and actor nodes registered here live
+    */
     class UpdatePhysicsSystemCallback : public osg::NodeCallback
     {
     public:
         UpdatePhysicsSystemCallback(const std::string& sceneName = "")
-            : _sceneName(sceneName), _numTotalWheels(0), _maxSimulationDelta(0.0), _lastSimulationTime(0.0), _frameTime(0.02) {}
+            : _sceneName(sceneName), _numTotalWheels(0), _maxSimulationDelta(0.0), _lastSimulationTime(0.0), _frameTime(0.02),
+            _fixedTimeStep(0.0), _accumulator(0.0), _maxSubSteps(5), _syncedSteps(0), _asyncUpdate(false) {}
 
         UpdatePhysicsSystemCallback(const UpdatePhysicsSystemCallback& copy, const osg::CopyOp& op = osg::CopyOp::SHALLOW_COPY)
             : osg::NodeCallback(copy, op), _sceneName(copy._sceneName), _numTotalWheels(copy._numTotalWheels),
-            _maxSimulationDelta(copy._maxSimulationDelta), _frameTime(copy._frameTime) {}
+            _maxSimulationDelta(copy._maxSimulationDelta), _frameTime(copy._frameTime), _fixedTimeStep(copy._fixedTimeStep),
+            _accumulator(0.0), _maxSubSteps(copy._maxSubSteps), _syncedSteps(0), _asyncUpdate(copy._asyncUpdate),
+            _lodManager(copy._lodManager) {}
 
         META_Object(osgPhysics, UpdatePhysicsSystemCallback);
 
-        void addVehicle(WheeledVehicle* vehicle);
+        /** Add vehicle to be simulated. If the component group is also set, its children (matrix transforms of
+            wheels and then the chassis) are updated and vehicle inputs are handled here together with all other
+            vehicles, so UpdateVehicleCallback is not needed for it
+        */
+        void addVehicle(WheeledVehicle* vehicle, osg::Group* components = NULL);
+
+        /** Remove the vehicle, which is made dynamic again if the LOD manager has made it kinematic or frozen */
+        bool removeVehicle(WheeledVehicle* vehicle);
         void computeTotalWheels();
 
         std::vector<WheeledVehicle*>& getVehicles() { return _vehicles; }
         const std::vector<WheeledVehicle*>& getVehicles() const { return _vehicles; }
+
+        /** Add character controller to be moved together with all others of the scene once per frame before
+            simulating, see CharacterControlManager::update(). If the node is also set, it is translated to the
+            character position here, so UpdateCharacterCallback is not needed for it
+        */
+        void addCharacter(CharacterController* character, osg::MatrixTransform* node = NULL);
+        bool removeCharacter(CharacterController* character);
+
+        std::vector<CharacterController*>& getCharacters() { return _characters; }
+        const std::vector<CharacterController*>& getCharacters() const { return _characters; }
+
+        /** Set the level-of-detail manager to simulate far vehicles and characters in cheaper tiers.
+            Call PhysicsLODManager::reset() before unsetting it, so that all vehicles become dynamic again
+        */
+        void setLODManager(PhysicsLODManager* lod) { _lodManager = lod; }
+        PhysicsLODManager* getLODManager() { return _lodManager.get(); }
         virtual void operator()(osg::Node* node, osg::NodeVisitor* nv);
 
         void setMaxSimuationDeltaTime(double t) { _maxSimulationDelta = t; }
@@ -45,33 +76,105 @@ namespace osgPhysics
         void setFrameTime(double t) { _frameTime = t; }
         double getFrameTime() const { return _frameTime; }
 
+        /** Set a fixed simulation step (> 0) to enable the time accumulator, which replaces the variable-sized
+            slicing of setMaxSimuationDeltaTime(). Unsimulated remainder is published as the interpolation factor
+            of every scene stepped, so that actor and vehicle callbacks can blend previous and current poses
+        */
+        void setFixedTimeStep(double dt) { _fixedTimeStep = dt; }
+        double getFixedTimeStep() const { return _fixedTimeStep; }
+
+        /** Set max number of fixed steps to catch up in one frame, time beyond that will be dropped */
+        void setMaxSubSteps(unsigned int n) { _maxSubSteps = n; }
+        unsigned int getMaxSubSteps() const { return _maxSubSteps; }
+
+        /** Register a matrix transform to be updated by the scene-level sync stage, which only visits actors
+            reported by PxScene::getActiveActors() after each step, instead of polling every actor with its own
+            UpdateActorCallback. Poses are blended automatically if a fixed time step is set.
+            Note that the actor must be added to the scene of this updater first, whose actor data will be used to
+            locate the node
+        */
+        void addActorNode(physx::PxRigidActor* actor, osg::MatrixTransform* node);
+        bool removeActorNode(physx::PxRigidActor* actor);
+
+        /** Reset saved poses of the registered node after teleporting its actor, so it is not blended from the old place */
+        bool resetActorNode(physx::PxRigidActor* actor);
+        unsigned int getNumActorNodes() const { return _actorNodes.size(); }
+
+        /** Set to start the last simulation step at the end of the update traversal and fetch its results
+            at the beginning of next frame, so that cull and draw can overlap the solver.
+            Scene graph callbacks always see results of the previous step in this mode
+        */
+        void setAsyncUpdate(bool b) { _asyncUpdate = b; }
+        bool getAsyncUpdate() const { return _asyncUpdate; }
+
     protected:
+        void simulateStep(double dt, bool lastStep, double& asyncStep);
+        void syncSimulatedStep();
+        void syncActiveActors();
+        void applyActorNodes(double alpha);
+
+        struct ActorNode
+        {
+            physx::PxRigidActor* actor;
+            osg::observer_ptr<osg::MatrixTransform> node;
+            physx::PxTransform previousPose, currentPose;
+        };
+        std::vector<ActorNode> _actorNodes;
+        std::vector<unsigned int> _movingActorNodes, _settledActorNodes;
+        std::vector<physx::PxTransform> _batchPoses;
+        std::vector<osg::Matrix> _batchMatrices;
+
         std::vector<WheeledVehicle*> _vehicles;
+        std::vector< osg::observer_ptr<osg::Group> > _vehicleNodes;
         std::vector<physx::PxVehicleWheels*> _vehicleEngines;
         std::vector<physx::PxVehicleWheelQueryResult> _queryResults;
 
+        std::vector<CharacterController*> _characters;
+        std::vector< osg::observer_ptr<osg::MatrixTransform> > _characterNodes;
+
+        osg::ref_ptr<PhysicsLODManager> _lodManager;
+        PhysicsLODManager::Selection _lodSelection;
+
         std::string _sceneName;
         unsigned int _numTotalWheels;
         double _maxSimulationDelta;
         double _lastSimulationTime;
         double _frameTime;
+        double _fixedTimeStep;
+        double _accumulator;
+        unsigned int _maxSubSteps;
+        unsigned int _syncedSteps;  // Engine::getNumSimulatedSteps() when nodes were last synced
+        bool _asyncUpdate;
     };
 
     /** The callback to update the actor, should be applied to a matrix transform node */
     class UpdateActorCallback : public osg::NodeCallback
     {
     public:
-        UpdateActorCallback(physx::PxRigidActor* a = 0) : _actor(a) {}
+        UpdateActorCallback(physx::PxRigidActor* a = 0)
+            : _actor(a), _lastNumSteps(0), _interpolated(false), _hasPoses(false) {}
 
         UpdateActorCallback(const UpdateActorCallback& copy, const osg::CopyOp& op = osg::CopyOp::SHALLOW_COPY)
-            : osg::NodeCallback(copy, op), _actor(copy._actor) {}
+            : osg::NodeCallback(copy, op), _actor(copy._actor), _lastNumSteps(0),
+            _interpolated(copy._interpolated), _hasPoses(false) {}
 
         META_Object(osgPhysics, UpdateActorCallback);
 
         virtual void operator()(osg::Node* node, osg::NodeVisitor* nv);
 
+        /** Set to blend previous and current poses with the interpolation factor of the actor's scene.
+            Poses are recorded once per frame, so blending is only exact when at most one fixed step is simulated
+            in each frame; otherwise register the node with UpdatePhysicsSystemCallback::addActorNode() instead,
+            which records the pose before every step
+        */
+        void setInterpolated(bool b) { _interpolated = b; }
+        bool getInterpolated() const { return _interpolated; }
+
     protected:
         physx::PxRigidActor* _actor;
+        physx::PxTransform _previousPose, _currentPose;
+        unsigned int _lastNumSteps;
+        bool _interpolated, _hasPoses;
     };
 
     /** The callback to update the character controller */
@@ -97,15 +200,16 @@ namespace osgPhysics
         double _frameTime;
     };
 
-    /** The callback to update the vehicle */
+    /** The callback to update the vehicle, which must also be added to UpdatePhysicsSystemCallback for simulating */
     class UpdateVehicleCallback : public osg::NodeCallback
     {
     public:
         UpdateVehicleCallback(WheeledVehicle* car = 0)
-            : _physicsVehicle(car), _lastSimulationTime(0.0), _frameTime(0.02) {}
+            : _physicsVehicle(car), _lastSimulationTime(0.0), _frameTime(0.02), _interpolated(false) {}
 
         UpdateVehicleCallback(const UpdateVehicleCallback& copy, const osg::CopyOp& op = osg::CopyOp::SHALLOW_COPY)
-            : osg::NodeCallback(copy, op), _physicsVehicle(copy._physicsVehicle), _frameTime(copy._frameTime) {}
+            : osg::NodeCallback(copy, op), _physicsVehicle(copy._physicsVehicle), _frameTime(copy._frameTime),
+            _interpolated(copy._interpolated) {}
 
         META_Object(osgPhysics, UpdateVehicleCallback);
 
@@ -114,10 +218,16 @@ namespace osgPhysics
         void setFrameTime(double t) { _frameTime = t; }
         double getFrameTime() const { return _frameTime; }
 
+        /** Set to blend previous and current component poses with the interpolation factor of the vehicle's scene */
+        void setInterpolated(bool b) { _interpolated = b; }
+        bool getInterpolated() const { return _interpolated; }
+
     protected:
         WheeledVehicle* _physicsVehicle;
+        std::vector<osg::Matrix> _matrices;
         double _lastSimulationTime;
         double _frameTime;
+        bool _interpolated;
     };
 
 }
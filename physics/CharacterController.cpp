@@ -1,6 +1,7 @@
 #include <osg/io_utils>
 #include "PhysicsUtil.h"
 #include "CharacterController.h"
+#include "Profiler.h"
 #include <algorithm>
 #include <iostream>
 
@@ -19,6 +20,7 @@ CharacterControlManager* CharacterControlManager::instance()
 }
 
 CharacterControlManager::CharacterControlManager()
+    : _characterBatchSize(0), _lockingEnabled(false)
 {
 }
 
@@ -35,8 +37,9 @@ physx::PxControllerManager* CharacterControlManager::getOrCreateManager(physx::P
     physx::PxControllerManager* manager = _managers[scene];
     if (!manager)
     {
-        manager = PxCreateControllerManager(*scene);
+        manager = PxCreateControllerManager(*scene, _lockingEnabled);
         _managers[scene] = manager;
+        if (_lockingEnabled) _lockedManagers.insert(manager);
     }
     return manager;
 }
@@ -65,6 +68,51 @@ void CharacterControlManager::removeObstacle(physx::PxScene* scene)
     if (itr != _obstacleContexts.end()) { itr->second->release(); _obstacleContexts.erase(itr); }
 }
 
+void CharacterControlManager::update(double step, PxScene* scene, std::vector<CharacterController*>& characters,
+                                     float offsetScale)
+{
+    std::map<PxScene*, PxControllerManager*>::iterator itr = _managers.find(scene);
+    if (itr == _managers.end() || step <= 0.0 || characters.empty()) return;
+
+    // Resolve overlaps between characters once, before any of them moves
+    ProfileScope profile(Profiler::CHARACTER_MOVE, scene);
+    PxControllerManager* manager = itr->second;
+    manager->computeInteractions((PxF32)step);
+    PxObstacleContext* obstacles = getObstacle(scene);
+
+    unsigned int size = characters.size();
+    bool parallel = _characterBatchSize > 0 && size > _characterBatchSize && scene->getCpuDispatcher() &&
+                    _lockedManagers.find(manager) != _lockedManagers.end();
+    if (!parallel)
+    {
+        for (unsigned int i = 0; i < size; ++i)
+            characters[i]->updateMovement(step, obstacles, offsetScale);
+        return;
+    }
+
+    unsigned int numBatches = (size + _characterBatchSize - 1) / _characterBatchSize;
+    _batches.resize(numBatches);
+    _batchJobs.resize(numBatches);
+    for (unsigned int b = 0; b < numBatches; ++b)
+    {
+        CharacterBatch& batch = _batches[b];
+        unsigned int start = b * _characterBatchSize;
+        batch.characters = &(characters[start]);
+        batch.numCharacters = std::min(_characterBatchSize, size - start);
+        batch.obstacles = obstacles;
+        batch.step = step;
+        batch.offsetScale = offsetScale;
+        _batchJobs[b] = &batch;
+    }
+    _batchTasks.run(scene->getCpuDispatcher(), &(_batchJobs[0]), numBatches);
+}
+
+void CharacterControlManager::CharacterBatch::run()
+{
+    for (unsigned int i = 0; i < numCharacters; ++i)
+        characters[i]->updateMovement(step, obstacles, offsetScale);
+}
+
 /* CharacterController */
 
 CharacterController::ControllerData::ControllerData(float d, const osg::Vec3& p, const osg::Vec3& u)
@@ -150,11 +198,18 @@ void CharacterController::move(const osg::Vec3& offset, float gravityScale)
 
 physx::PxControllerCollisionFlags CharacterController::updateMovement(double step)
 {
-    PxVec3 offset(_offset[0], _offset[1], _offset[2]);
-    const static float minOffsetDistance = 0.001f;
+    ProfileScope profile(Profiler::CHARACTER_MOVE, _controllerScene);
     physx::PxObstacleContext* obManager =
         CharacterControlManager::instance()->getObstacle(_controllerScene);
-    return _controller->move(offset, minOffsetDistance, step, PxControllerFilters(), obManager);
+    return updateMovement(step, obManager);
+}
+
+physx::PxControllerCollisionFlags CharacterController::updateMovement(double step, physx::PxObstacleContext* obstacles,
+                                                                     float offsetScale)
+{
+    PxVec3 offset(_offset[0], _offset[1], _offset[2]); offset *= offsetScale;
+    const static float minOffsetDistance = 0.001f;
+    return _controller->move(offset, minOffsetDistance, step, PxControllerFilters(), obstacles);
 }
 
 void CharacterController::updateObstacle(physx::ObstacleHandle handle, const physx::PxObstacle& obstacle)
@@ -4,10 +4,14 @@
 #include <osg/Referenced>
 #include <osg/Vec3>
 #include "Engine.h"
+#include "TaskGroup.h"
+#include <set>
 
 namespace osgPhysics
 {
 
+    class CharacterController;
+
     /** The character controller manager */
     class CharacterControlManager : public osg::Referenced
     {
@@ -19,11 +23,49 @@ namespace osgPhysics
         physx::PxObstacleContext* getObstacle(physx::PxScene* scene);
         void removeObstacle(physx::PxScene* scene);
 
+        /** Set to create controller managers of new scenes with internal locking, which is required for moving
+            characters in parallel. It must be set before creating the first character of the scene
+        */
+        void setLockingEnabled(bool b) { _lockingEnabled = b; }
+        bool getLockingEnabled() const { return _lockingEnabled; }
+
+        /** Set max number of characters in one batch (> 0) to move batches in parallel on the scene's CPU
+            dispatcher, if the manager of the scene has locking enabled. 0 to move all on the calling thread.
+            Note that hit reports of characters are then called from worker threads
+        */
+        void setCharacterBatchSize(unsigned int n) { _characterBatchSize = n; }
+        unsigned int getCharacterBatchSize() const { return _characterBatchSize; }
+
+        /** Move all characters of the scene in one pass: interactions between characters are computed once with
+            PxControllerManager::computeInteractions() and the obstacle context is looked up only once
+        */
+        virtual void update(double step, physx::PxScene* scene, std::vector<CharacterController*>& characters,
+                            float offsetScale = 1.0f);
+
     protected:
         CharacterControlManager();
         virtual ~CharacterControlManager();
+
+        /** Characters moved together by one task */
+        struct CharacterBatch : public TaskGroup::Job
+        {
+            virtual void run();
+
+            CharacterController** characters;
+            physx::PxObstacleContext* obstacles;
+            double step;
+            float offsetScale;
+            unsigned int numCharacters;
+        };
+
         std::map<physx::PxScene*, physx::PxControllerManager*> _managers;
         std::map<physx::PxScene*, physx::PxObstacleContext*> _obstacleContexts;
+        std::set<physx::PxControllerManager*> _lockedManagers;
+        std::vector<CharacterBatch> _batches;
+        std::vector<TaskGroup::Job*> _batchJobs;
+        TaskGroup _batchTasks;
+        unsigned int _characterBatchSize;
+        bool _lockingEnabled;
     };
 
     /** The character controller */
@@ -79,6 +121,17 @@ namespace osgPhysics
         /** Update the controller movement every frame */
         physx::PxControllerCollisionFlags updateMovement(double step);
 
+        /** Update the controller movement with the obstacle context of its scene (or NULL) already looked up.
+            The offset could be scaled if the character is moved less frequently than once per frame
+        */
+        physx::PxControllerCollisionFlags updateMovement(double step, physx::PxObstacleContext* obstacles,
+                                                         float offsetScale = 1.0f);
+
+        /** Get the offset set by move() for every frame, gravity included */
+        const osg::Vec3& getMoveOffset() const { return _offset; }
+
+        physx::PxScene* getScene() { return _controllerScene; }
+
         /** Add/update an invisible obstacle. Set handle to 0 if you want to add new */
         void updateObstacle(physx::ObstacleHandle handle, const physx::PxObstacle& obstacle);
         void removeObstacle(physx::ObstacleHandle handle, bool removeAll);
@@ -0,0 +1,216 @@
+#include <osgDB/FileNameUtils>
+#include <osgDB/FileUtils>
+#include <OpenThreads/ScopedLock>
+#include "PhysicsUtil.h"
+#include "CookingCache.h"
+#include <algorithm>
+#include <fstream>
+#include <sstream>
+#include <iomanip>
+#include <stdio.h>
+#include <string.h>
+#include <sys/stat.h>
+
+#ifdef WIN32
+#   include <sys/utime.h>
+#   define utime _utime
+#else
+#   include <utime.h>
+#endif
+
+using namespace osgPhysics;
+using namespace physx;
+
+/** Header of a cached file, any mismatch makes the file outdated */
+struct CacheFileHeader
+{
+    char magic[4];
+    PxU32 formatVersion, physicsVersion, pointerSize, type, dataSize;
+    PxU64 key;
+};
+
+static const char s_cacheMagic[4] = { 'O', 'P', 'X', 'C' };
+static const PxU32 s_cacheFormatVersion = 1;
+static const char* s_cacheExtension = "pxc";
+
+static PxU64 getFileSize(const std::string& fileName)
+{
+    struct stat st;
+    return stat(fileName.c_str(), &st) == 0 ? (PxU64)st.st_size : 0;
+}
+
+void CookingHash::addCookingParams(const PxCookingParams& params)
+{
+    // Add fields one by one to avoid hashing padding bytes
+    addValue(params.areaTestEpsilon);
+    addValue(params.planeTolerance);
+    addValue((PxU32)params.convexMeshCookingType);
+    addValue(params.suppressTriangleMeshRemapTable);
+    addValue(params.buildTriangleAdjacencies);
+    addValue(params.buildGPUData);
+    addValue(params.scale.length);
+    addValue(params.scale.speed);
+    addValue((PxU32)params.meshPreprocessParams);
+    addValue(params.meshWeldTolerance);
+    addValue(params.gaussMapLimit);
+
+    // Only the active member of the midphase union is meaningful
+    const PxMidphaseDesc& midphase = params.midphaseDesc;
+    addValue((PxU32)midphase.getType());
+    if (midphase.getType() == PxMeshMidPhase::eBVH33)
+    {
+        addValue((PxU32)midphase.mBVH33Desc.meshCookingHint);
+        addValue(midphase.mBVH33Desc.meshSizePerformanceTradeOff);
+    }
+    else if (midphase.getType() == PxMeshMidPhase::eBVH34)
+        addValue(midphase.mBVH34Desc.numTrisPerLeaf);
+}
+
+CookingCache* CookingCache::instance()
+{
+    static osg::ref_ptr<CookingCache> s_registry = new CookingCache;
+    return s_registry.get();
+}
+
+CookingCache::CookingCache()
+    : _maxCacheSize(256 * 1024 * 1024), _totalSize(0)
+{
+}
+
+void CookingCache::setDirectory(const std::string& dir)
+{
+    OpenThreads::ScopedLock<OpenThreads::Mutex> lock(_mutex);
+    if (!dir.empty() && !osgDB::makeDirectory(dir))
+    {
+        OSG_WARN << "[CookingCache] Failed to create cache directory " << dir << std::endl;
+        _directory = ""; _totalSize = 0; return;
+    }
+
+    // Scan existing files once here, then the total size is tracked while writing and removing files
+    _directory = dir; _totalSize = 0;
+    if (!_directory.empty()) evict();
+}
+
+std::string CookingCache::getFileName(DataType type, PxU64 key) const
+{
+    std::stringstream ss;
+    ss << type << "_" << std::hex << std::setw(16) << std::setfill('0') << key << "." << s_cacheExtension;
+    return osgDB::concatPaths(_directory, ss.str());
+}
+
+PxInputData* CookingCache::read(DataType type, PxU64 key)
+{
+    if (!isEnabled()) return NULL;
+    std::string fileName = getFileName(type, key);
+    if (!osgDB::fileExists(fileName)) { ++_numMisses; return NULL; }
+
+    MappedFileInputData* input = new MappedFileInputData;
+    if (input->open(fileName) && input->getFileSize() >= sizeof(CacheFileHeader))
+    {
+        CacheFileHeader header;
+        memcpy(&header, input->getFileData(), sizeof(CacheFileHeader));
+        if (!memcmp(header.magic, s_cacheMagic, 4) && header.formatVersion == s_cacheFormatVersion &&
+            header.physicsVersion == PX_PHYSICS_VERSION && header.pointerSize == sizeof(void*) &&
+            header.type == (PxU32)type && header.key == key &&
+            input->setRange(sizeof(CacheFileHeader), header.dataSize) &&
+            header.dataSize == input->getFileSize() - sizeof(CacheFileHeader))
+        {
+            // Touch the file so that eviction works as least-recently-used
+            utime(fileName.c_str(), NULL);
+            ++_numHits; return input;
+        }
+    }
+
+    OSG_NOTICE << "[CookingCache] Removing outdated file " << fileName << std::endl;
+    delete input;
+    {
+        OpenThreads::ScopedLock<OpenThreads::Mutex> lock(_mutex);
+        PxU64 fileSize = getFileSize(fileName);
+        if (remove(fileName.c_str()) == 0) _totalSize -= PxMin(_totalSize, fileSize);
+    }
+    ++_numMisses; return NULL;
+}
+
+bool CookingCache::write(DataType type, PxU64 key, const PxU8* data, PxU32 size)
+{
+    if (!isEnabled() || !data || !size) return false;
+    CacheFileHeader header;
+    memcpy(header.magic, s_cacheMagic, 4);
+    header.formatVersion = s_cacheFormatVersion;
+    header.physicsVersion = PX_PHYSICS_VERSION;
+    header.pointerSize = sizeof(void*);
+    header.type = (PxU32)type;
+    header.dataSize = size;
+    header.key = key;
+
+    // Write to a temporary file first, so that other readers never see partial data
+    std::string fileName = getFileName(type, key);
+    std::stringstream tempName; tempName << fileName << "." << (void*)data << ".tmp";
+    {
+        std::ofstream out(tempName.str().c_str(), std::ios::out | std::ios::binary);
+        if (!out)
+        {
+            OSG_WARN << "[CookingCache] Failed to write " << tempName.str() << std::endl;
+            return false;
+        }
+        out.write((const char*)&header, sizeof(CacheFileHeader));
+        out.write((const char*)data, size);
+        if (!out) { out.close(); remove(tempName.str().c_str()); return false; }
+    }
+
+    OpenThreads::ScopedLock<OpenThreads::Mutex> lock(_mutex);
+    PxU64 oldSize = getFileSize(fileName);
+    if (remove(fileName.c_str()) == 0) _totalSize -= PxMin(_totalSize, oldSize);
+    if (rename(tempName.str().c_str(), fileName.c_str()) != 0)
+    { remove(tempName.str().c_str()); return false; }
+
+    _totalSize += sizeof(CacheFileHeader) + size;
+    if (_totalSize > _maxCacheSize) evict();
+    return true;
+}
+
+void CookingCache::clear()
+{
+    OpenThreads::ScopedLock<OpenThreads::Mutex> lock(_mutex);
+    if (!isEnabled()) return;
+
+    osgDB::DirectoryContents contents = osgDB::getDirectoryContents(_directory);
+    for (unsigned int i = 0; i < contents.size(); ++i)
+    {
+        if (osgDB::getLowerCaseFileExtension(contents[i]) != s_cacheExtension) continue;
+        remove(osgDB::concatPaths(_directory, contents[i]).c_str());
+    }
+    _totalSize = 0;
+}
+
+void CookingCache::evict()
+{
+    typedef std::pair<time_t, std::pair<std::string, PxU64> > FileEntry;
+    std::vector<FileEntry> files;
+    PxU64 totalSize = 0;
+
+    osgDB::DirectoryContents contents = osgDB::getDirectoryContents(_directory);
+    for (unsigned int i = 0; i < contents.size(); ++i)
+    {
+        if (osgDB::getLowerCaseFileExtension(contents[i]) != s_cacheExtension) continue;
+        std::string fileName = osgDB::concatPaths(_directory, contents[i]);
+
+        struct stat st;
+        if (stat(fileName.c_str(), &st) != 0) continue;
+        files.push_back(FileEntry(st.st_mtime, std::pair<std::string, PxU64>(fileName, (PxU64)st.st_size)));
+        totalSize += (PxU64)st.st_size;
+    }
+    _totalSize = totalSize;
+    if (totalSize <= _maxCacheSize) return;
+
+    // Remove least recently used files first, down to a bit under the limit so that the following writes
+    // don't have to scan the directory again at once
+    PxU64 targetSize = _maxCacheSize - _maxCacheSize / 8;
+    std::sort(files.begin(), files.end());
+    for (unsigned int i = 0; i < files.size() && totalSize > targetSize; ++i)
+    {
+        if (remove(files[i].second.first.c_str()) == 0)
+            totalSize -= files[i].second.second;
+    }
+    _totalSize = totalSize;
+}
@@ -0,0 +1,95 @@
+#ifndef PHYSICS_COOKINGCACHE
+#define PHYSICS_COOKINGCACHE
+
+#include <osg/Referenced>
+#include <OpenThreads/Atomic>
+#include <OpenThreads/Mutex>
+#include "Engine.h"
+
+namespace osgPhysics
+{
+
+    /** 64-bit FNV-1a hash for building keys of cooked data */
+    class CookingHash
+    {
+    public:
+        CookingHash() : _value(14695981039346656037ULL) {}
+
+        void add(const void* data, unsigned int size)
+        {
+            const physx::PxU8* ptr = (const physx::PxU8*)data;
+            for (unsigned int i = 0; i < size; ++i)
+            { _value ^= ptr[i]; _value *= 1099511628211ULL; }
+        }
+
+        template<typename T> void addValue(const T& v) { add(&v, sizeof(T)); }
+
+        /** Add the strided data of a PhysX descriptor, element by element */
+        void addStrided(const physx::PxBoundedData& data, unsigned int elementSize)
+        {
+            const physx::PxU8* ptr = (const physx::PxU8*)data.data;
+            if (!ptr) return;
+            if (data.stride == elementSize) add(ptr, data.count * elementSize);
+            else for (unsigned int i = 0; i < data.count; ++i) add(ptr + i * data.stride, elementSize);
+        }
+
+        /** Add parameters of the cooking object which affect cooked data */
+        void addCookingParams(const physx::PxCookingParams& params);
+
+        physx::PxU64 get() const { return _value; }
+
+    protected:
+        physx::PxU64 _value;
+    };
+
+    /** The global on-disk cache of cooked PhysX streams, keyed by hashes of source data and cooking parameters.
+        Cached files are memory mapped when being read, and the least recently used ones are evicted when the
+        total size exceeds the limit. Disabled until a cache directory is set
+    */
+    class CookingCache : public osg::Referenced
+    {
+    public:
+        static CookingCache* instance();
+
+        enum DataType { CONVEX_MESH = 1, TRIANGLE_MESH, HEIGHT_FIELD };
+
+        /** Set the cache directory, which is created if not existing. Set to empty to disable the cache */
+        void setDirectory(const std::string& dir);
+        const std::string& getDirectory() const { return _directory; }
+        bool isEnabled() const { return !_directory.empty(); }
+
+        /** Set max total size in bytes of all cached files, checked when writing new files */
+        void setMaxCacheSize(physx::PxU64 bytes) { _maxCacheSize = bytes; }
+        physx::PxU64 getMaxCacheSize() const { return _maxCacheSize; }
+
+        /** Open cached data for reading, returns NULL if not found or outdated. The result must be deleted after use */
+        physx::PxInputData* read(DataType type, physx::PxU64 key);
+
+        /** Save cooked data, and evict old files if exceeding max size */
+        bool write(DataType type, physx::PxU64 key, const physx::PxU8* data, physx::PxU32 size);
+
+        /** Remove all cached files */
+        void clear();
+
+        unsigned int getNumHits() const { return (unsigned int)_numHits; }
+        unsigned int getNumMisses() const { return (unsigned int)_numMisses; }
+        void resetCounters() { _numHits.exchange(0); _numMisses.exchange(0); }
+
+    protected:
+        CookingCache();
+        virtual ~CookingCache() {}
+
+        std::string getFileName(DataType type, physx::PxU64 key) const;
+
+        /** Scan the directory to update total size, and remove least recently used files if exceeding max size */
+        void evict();
+
+        std::string _directory;
+        physx::PxU64 _maxCacheSize, _totalSize;
+        OpenThreads::Atomic _numHits, _numMisses;
+        OpenThreads::Mutex _mutex;
+    };
+
+}
+
+#endif
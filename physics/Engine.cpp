@@ -1,11 +1,78 @@
 #include <osg/io_utils>
+#include <osg/Timer>
+#include <osgDB/FileNameUtils>
+#include <OpenThreads/Condition>
+#include <OpenThreads/ScopedLock>
 #include "PhysicsUtil.h"
+#include "Profiler.h"
 #include <algorithm>
 #include <iostream>
 
 using namespace osgPhysics;
 using namespace physx;
 
+namespace osgPhysics
+{
+
+    /** The completion task passed to PxScene::simulate(), which only records the time
+        the scene finished its step so that per-scene costs could be measured while all scenes run together.
+        PhysX may signal the fetch event before releasing the task, so its state is guarded by a mutex
+    */
+    class SceneCompletionTask : public PxBaseTask
+    {
+    public:
+        SceneCompletionTask() : _startTick(0), _endTick(0), _refCount(0) {}
+
+        /** Wait for a late release of the previous step, then start timing a new one */
+        void start()
+        {
+            OpenThreads::ScopedLock<OpenThreads::Mutex> lock(_mutex);
+            while (_refCount > 0) _condition.wait(&_mutex);
+            _startTick = osg::Timer::instance()->tick();
+            _endTick = _startTick;
+        }
+
+        osg::Timer_t getStartTick() const { return _startTick; }
+
+        /** Get the time the step finished, or the fallback if the task is not released by PhysX yet */
+        osg::Timer_t getEndTick(osg::Timer_t fallback) const
+        {
+            OpenThreads::ScopedLock<OpenThreads::Mutex> lock(_mutex);
+            return _refCount == 0 ? _endTick : fallback;
+        }
+
+        virtual void run() {}
+        virtual const char* getName() const { return "osgPhysics.SceneCompletion"; }
+        virtual void release() {}
+
+        virtual void addReference()
+        {
+            OpenThreads::ScopedLock<OpenThreads::Mutex> lock(_mutex);
+            ++_refCount;
+        }
+
+        virtual PxI32 getReference() const
+        {
+            OpenThreads::ScopedLock<OpenThreads::Mutex> lock(_mutex);
+            return _refCount;
+        }
+
+        virtual void removeReference()
+        {
+            OpenThreads::ScopedLock<OpenThreads::Mutex> lock(_mutex);
+            if (_refCount == 1) _endTick = osg::Timer::instance()->tick();
+            if (--_refCount == 0) _condition.broadcast();
+        }
+
+    protected:
+        osg::Timer_t _startTick, _endTick;
+        PxI32 _refCount;
+        mutable OpenThreads::Mutex _mutex;
+        OpenThreads::Condition _condition;
+    };
+
+}
+
 class ErrorCallback : public PxErrorCallback
 {
 public:
@@ -27,7 +94,8 @@ Engine* Engine::instance()
 }
 
 Engine::Engine()
-    : _cooking(NULL), _cudaManager(NULL), _pvdTransport(NULL), _pvd(NULL)
+    : _cooking(NULL), _cudaManager(NULL), _pvdTransport(NULL), _pvd(NULL),
+    _numSimulatedSteps(0), _simulating(false)
 {
 #if (PX_PHYSICS_VERSION_MAJOR > 3)
     PxFoundation* foundation = PxCreateFoundation(PX_PHYSICS_VERSION, defaultAllocator, errorHandler);
@@ -78,12 +146,18 @@ Engine::~Engine()
     if (_pvdTransport) _pvdTransport->release();
     if (_cooking) _cooking->release();
     if (_cudaManager) _cudaManager->release();
+
+    for (CpuDispatcherMap::iterator itr = _cpuDispatchers.begin(); itr != _cpuDispatchers.end(); ++itr)
+        itr->second->release();
 }
 
 bool Engine::addScene(const std::string& name, PxScene* s)
 {
     if (!s || _sceneMap.find(name) != _sceneMap.end()) return false;
+    endUpdate();  // a new scene must not be fetched before it is ever simulated
     _sceneMap[name] = s;
+    _sceneIds[name] = _scenesById.size();
+    _scenesById.push_back(s);
     return true;
 }
 
@@ -91,16 +165,48 @@ bool Engine::removeScene(const std::string& name, bool doRelease)
 {
     SceneMap::iterator itr = _sceneMap.find(name);
     if (itr == _sceneMap.end()) return false;
+    endUpdate();
 
+    for (unsigned int i = 0; i < _sceneObservers.size(); ++i)
+        _sceneObservers[i]->sceneRemoved(itr->second);
     if (doRelease)
     {
         releaseActors(itr->second);
+        releaseSerializedData(itr->second);
         itr->second->release();
     }
+
+    std::map<PxScene*, SceneCompletionTask*>::iterator titr = _completionTasks.find(itr->second);
+    if (titr != _completionTasks.end()) { delete titr->second; _completionTasks.erase(titr); }
+    Profiler::instance()->removeRecords(itr->second);
+    _snapshots.erase(itr->second);
+    _actorListVersions.erase(itr->second);
+    _sceneTimings.erase(name);
+    _interpolationFactors.erase(itr->second);
+    _scenesById[_sceneIds[name]] = NULL;  // ids are never reused
+    _sceneIds.erase(name);
     _sceneMap.erase(itr);
     return true;
 }
 
+double Engine::getInterpolationFactor(const PxScene* scene) const
+{
+    std::map<const PxScene*, double>::const_iterator itr = _interpolationFactors.find(scene);
+    return (itr != _interpolationFactors.end()) ? itr->second : 1.0;
+}
+
+void Engine::addSceneObserver(SceneObserver* observer)
+{
+    if (observer && std::find(_sceneObservers.begin(), _sceneObservers.end(), observer) == _sceneObservers.end())
+        _sceneObservers.push_back(observer);
+}
+
+void Engine::removeSceneObserver(SceneObserver* observer)
+{
+    std::vector<SceneObserver*>::iterator itr = std::find(_sceneObservers.begin(), _sceneObservers.end(), observer);
+    if (itr != _sceneObservers.end()) _sceneObservers.erase(itr);
+}
+
 PxScene* Engine::getScene(const std::string& name)
 {
     SceneMap::iterator itr = _sceneMap.find(name);
@@ -115,12 +221,52 @@ const PxScene* Engine::getScene(const std::string& name) const
     return itr->second;
 }
 
+unsigned int Engine::getSceneId(const std::string& name) const
+{
+    std::map<std::string, unsigned int>::const_iterator itr = _sceneIds.find(name);
+    return (itr != _sceneIds.end()) ? itr->second : ~0u;
+}
+
 bool Engine::addActor(const std::string& s, PxActor* actor)
 {
-    PxScene* scene = getScene(s);
+    return addActor(getSceneId(s), actor);
+}
+
+bool Engine::addActor(unsigned int sceneId, PxActor* actor)
+{
+    PxScene* scene = getScene(sceneId);
     if (!scene || !actor) return false;
+    if (findActorSlot(actor) != ~0u)
+    {
+        OSG_WARN << "[Engine] Actor is already added to a scene" << std::endl;
+        return false;
+    }
+
     scene->addActor(*actor);
-    _actorMap[scene].push_back(actor);
+    registerActor(scene, actor);
+    return true;
+}
+
+bool Engine::addActors(unsigned int sceneId, PxActor* const* actors, unsigned int numActors)
+{
+    PxScene* scene = getScene(sceneId);
+    if (!scene || !actors) return false;
+
+    // Mark userData of validated actors, so that duplicates in the batch are found too
+    void* const pending = (void*)~(size_t)0;
+    for (unsigned int i = 0; i < numActors; ++i)
+    {
+        if (!actors[i] || actors[i]->userData == pending || findActorSlot(actors[i]) != ~0u)
+        {
+            OSG_WARN << "[Engine] Invalid, repeated or already added actor found in the batch" << std::endl;
+            for (unsigned int j = 0; j < i; ++j) actors[j]->userData = NULL;
+            return false;
+        }
+        actors[i]->userData = pending;
+    }
+
+    scene->addActors(actors, numActors);
+    for (unsigned int i = 0; i < numActors; ++i) registerActor(scene, actors[i]);
     return true;
 }
 
@@ -148,18 +294,414 @@ bool Engine::addActor(const std::string& s, physx::PxParticleBase* ps, const phy
 bool Engine::removeActor(const std::string& s, PxActor* actor)
 {
     PxScene* scene = getScene(s);
-    if (!scene || !actor) return false;
+    unsigned int slotIndex = findActorSlot(actor);
+    if (!scene || slotIndex == ~0u || _actorSlots[slotIndex].scene != scene) return false;
 
+    scene->removeActor(*actor);
+    unregisterActor(slotIndex);
+    return true;
+}
+
+bool Engine::removeActor(PxActor* actor)
+{
+    unsigned int slotIndex = findActorSlot(actor);
+    if (slotIndex == ~0u) return false;
+
+    _actorSlots[slotIndex].scene->removeActor(*actor);
+    unregisterActor(slotIndex);
+    return true;
+}
+
+bool Engine::removeActor(ActorHandle handle)
+{
+    return removeActor(getActor(handle));
+}
+
+unsigned int Engine::removeActors(PxActor* const* actors, unsigned int numActors)
+{
+    // Remove actors of the same scene in batches. Actors are unregistered while collecting, so that
+    // repeated and unknown ones are skipped
+    unsigned int numRemoved = 0;
+    PxScene* batchScene = NULL;
+    _actorBatch.clear();
+    for (unsigned int i = 0; i < numActors; ++i)
+    {
+        unsigned int slotIndex = findActorSlot(actors[i]);
+        if (slotIndex == ~0u) continue;
+
+        PxScene* scene = _actorSlots[slotIndex].scene;
+        if (scene != batchScene && !_actorBatch.empty())
+        {
+            batchScene->removeActors(&(_actorBatch[0]), _actorBatch.size());
+            _actorBatch.clear();
+        }
+        batchScene = scene;
+        _actorBatch.push_back(actors[i]);
+        unregisterActor(slotIndex);
+        numRemoved++;
+    }
+
+    if (!_actorBatch.empty())
+    {
+        batchScene->removeActors(&(_actorBatch[0]), _actorBatch.size());
+        _actorBatch.clear();
+    }
+    return numRemoved;
+}
+
+Engine::ActorHandle Engine::getActorHandle(const PxActor* actor) const
+{
+    ActorHandle handle;
+    unsigned int slotIndex = findActorSlot(actor);
+    if (slotIndex != ~0u)
+    {
+        handle.index = slotIndex;
+        handle.generation = _actorSlots[slotIndex].generation;
+    }
+    return handle;
+}
+
+PxActor* Engine::getActor(ActorHandle handle) const
+{
+    if (handle.index >= _actorSlots.size()) return NULL;
+    const ActorSlot& slot = _actorSlots[handle.index];
+    return (slot.generation == handle.generation) ? slot.actor : NULL;
+}
+
+bool Engine::setActorData(PxActor* actor, void* data)
+{
+    unsigned int slotIndex = findActorSlot(actor);
+    if (slotIndex == ~0u) return false;
+    _actorSlots[slotIndex].data = data;
+    return true;
+}
+
+void* Engine::getActorData(const PxActor* actor) const
+{
+    unsigned int slotIndex = findActorSlot(actor);
+    return (slotIndex != ~0u) ? _actorSlots[slotIndex].data : NULL;
+}
+
+unsigned int Engine::findActorSlot(const PxActor* actor) const
+{
+    size_t index = actor ? (size_t)actor->userData : 0;
+    if (!index || index > _actorSlots.size() || _actorSlots[index - 1].actor != actor) return ~0u;
+    return index - 1;
+}
+
+void Engine::registerActor(PxScene* scene, PxActor* actor)
+{
+    unsigned int slotIndex = _actorSlots.size();
+    if (!_freeActorSlots.empty())
+    {
+        slotIndex = _freeActorSlots.back();
+        _freeActorSlots.pop_back();
+    }
+    else
+        _actorSlots.push_back(ActorSlot());
+
+    ActorList& actors = _actorMap[scene];
+    ActorSlot& slot = _actorSlots[slotIndex];
+    slot.actor = actor;
+    slot.scene = scene;
+    slot.data = NULL;
+    slot.listIndex = actors.size();
+    actors.push_back(actor);
+    actor->userData = (void*)(size_t)(slotIndex + 1);  // index + 1, so that NULL means not added
+    _actorListVersions[scene]++;
+}
+
+void Engine::unregisterActor(unsigned int slotIndex)
+{
+    // Swap-remove from the actor list of the scene, and fix list index of the moved one
+    ActorSlot& slot = _actorSlots[slotIndex];
+    ActorMap::iterator itr = _actorMap.find(slot.scene);
+    if (itr != _actorMap.end())
+    {
+        ActorList& actors = itr->second;
+        PxActor* last = actors.back();
+        actors[slot.listIndex] = last;
+        _actorSlots[(size_t)last->userData - 1].listIndex = slot.listIndex;
+        actors.pop_back();
+        if (actors.empty()) _actorMap.erase(itr);
+    }
+    _actorListVersions[slot.scene]++;
+
+    slot.actor->userData = NULL;
+    slot.actor = NULL;
+    slot.scene = NULL;
+    slot.data = NULL;
+    slot.generation++;
+    _freeActorSlots.push_back(slotIndex);
+}
+
+void Engine::addSharedObject(PxBase& object, PxSerialObjectId id)
+{
+    if (id > 1) _sharedObjects[id] = &object;
+    else OSG_WARN << "[Engine] Shared object id " << id << " is reserved" << std::endl;
+}
+
+PxCollection* Engine::createSharedCollection()
+{
+    // The default material is referenced by id instead of being duplicated by each collection
+    PxCollection* shared = PxCreateCollection();
+    shared->add(*_defaultMaterial, PxSerialObjectId(1));
+    for (std::map<PxSerialObjectId, PxBase*>::iterator itr = _sharedObjects.begin();
+         itr != _sharedObjects.end(); ++itr) shared->add(*(itr->second), itr->first);
+    return shared;
+}
+
+bool Engine::exportScene(const std::string& s, const std::string& file)
+{
+    PxScene* scene = getScene(s);
     ActorMap::iterator itr = _actorMap.find(scene);
-    if (itr == _actorMap.end()) return false;
+    if (!scene || itr == _actorMap.end()) return false;
 
+    PxSerializationRegistry* registry = PxSerialization::createSerializationRegistry(*_physicsSDK);
+    PxCollection* shared = createSharedCollection();
+    PxCollection* collection = PxCreateCollection();
     ActorList& actors = itr->second;
-    ActorList::iterator fitr = std::find(actors.begin(), actors.end(), actor);
-    if (fitr == actors.end()) return false;
+    for (unsigned int i = 0; i < actors.size(); ++i)
+    {
+        if (actors[i]->is<PxRigidActor>()) collection->add(*actors[i]);
+    }
 
-    scene->removeActor(*actor);
-    actors.erase(fitr);
-    if (!actors.size()) _actorMap.erase(itr);
+    bool succeed = false;
+    PxSerialization::complete(*collection, *registry, shared);
+    PxSerialObjectId firstId = _sharedObjects.empty() ? 2 : (_sharedObjects.rbegin()->first + 1);
+    PxSerialization::createSerialObjectIds(*collection, firstId);
+    if (PxSerialization::isSerializable(*collection, *registry, shared))
+    {
+        PxDefaultFileOutputStream out(file.c_str());
+        std::string ext = osgDB::getLowerCaseFileExtension(file);
+        if (!out.isValid())
+            OSG_WARN << "[Engine] Failed to write " << file << std::endl;
+        else if (ext == "repx" || ext == "xml")
+            succeed = PxSerialization::serializeCollectionToXml(
+                out, *collection, *registry, getOrCreateCooking(), shared);
+        else
+            succeed = PxSerialization::serializeCollectionToBinary(out, *collection, *registry, shared);
+    }
+    else
+        OSG_WARN << "[Engine] Scene " << s << " contains objects which are not serializable" << std::endl;
+
+    collection->release();
+    shared->release();
+    registry->release();
+    return succeed;
+}
+
+bool Engine::importScene(const std::string& s, const std::string& file)
+{
+    PxScene* scene = getScene(s);
+    if (!scene) return false;
+
+    std::string ext = osgDB::getLowerCaseFileExtension(file);
+    bool binary = !(ext == "repx" || ext == "xml");
+    MappedFileInputData* memory = new MappedFileInputData;
+    if (!memory->open(file, binary))
+    {
+        OSG_WARN << "[Engine] Failed to read " << file << std::endl;
+        delete memory; return false;
+    }
+
+    PxSerializationRegistry* registry = PxSerialization::createSerializationRegistry(*_physicsSDK);
+    PxCollection* shared = createSharedCollection();
+    PxCollection* collection = NULL;
+    if (binary)
+    {
+        // Mapped memory is always aligned to 128 bytes as required for in-place deserialization
+        collection = PxSerialization::createCollectionFromBinary(memory->getWritableFileData(), *registry, shared);
+    }
+    else
+    {
+        collection = PxSerialization::createCollectionFromXml(*memory, *getOrCreateCooking(), *registry, shared);
+        delete memory; memory = NULL;
+    }
+    shared->release();
+    registry->release();
+
+    if (!collection)
+    {
+        OSG_WARN << "[Engine] Failed to deserialize " << file << std::endl;
+        delete memory; return false;
+    }
+
+    std::vector<PxActor*> actors;
+    for (PxU32 i = 0; i < collection->getNbObjects(); ++i)
+    {
+        PxRigidActor* actor = collection->getObject(i).is<PxRigidActor>();
+        if (actor) actors.push_back(actor);
+    }
+    if (!actors.empty() && !addActors(getSceneId(s), &actors[0], actors.size()))
+    {
+        // Objects must be released before the memory they are deserialized in
+        OSG_WARN << "[Engine] Failed to add actors of " << file << " to scene " << s << std::endl;
+        PxCollectionExt::releaseObjects(*collection);
+        collection->release();
+        delete memory; return false;
+    }
+
+    SerializedData data;
+    data.collection = collection;
+    data.memory = memory;
+    _serializedDataMap[scene].push_back(data);
+    return true;
+}
+
+void Engine::setSnapshotCapacity(const std::string& s, unsigned int numFrames)
+{
+    PxScene* scene = getScene(s);
+    if (!scene) return;
+    if (!numFrames) { _snapshots.erase(scene); return; }
+
+    if (!(scene->getFlags() & PxSceneFlag::eENABLE_ENHANCED_DETERMINISM))
+        OSG_NOTICE << "[Engine] Scene " << s << " is not created with enhanced determinism, "
+                   << "which makes replaying from snapshots less accurate" << std::endl;
+
+    SnapshotRing& ring = _snapshots[scene];
+    ring.frames.clear();
+    ring.frames.resize(numFrames);
+    ring.nextFrame = 0;
+}
+
+void Engine::addSnapshotVehicle(const std::string& s, PxVehicleWheels* vehicle)
+{
+    std::map<PxScene*, SnapshotRing>::iterator itr = _snapshots.find(getScene(s));
+    if (itr == _snapshots.end() || !vehicle) return;
+
+    std::vector<PxVehicleWheels*>& vehicles = itr->second.vehicles;
+    if (std::find(vehicles.begin(), vehicles.end(), vehicle) != vehicles.end()) return;
+    vehicles.push_back(vehicle);
+    itr->second.actorListVersion = ~0u;  // force collecting again
+}
+
+void Engine::removeSnapshotVehicle(const std::string& s, PxVehicleWheels* vehicle)
+{
+    std::map<PxScene*, SnapshotRing>::iterator itr = _snapshots.find(getScene(s));
+    if (itr == _snapshots.end()) return;
+
+    std::vector<PxVehicleWheels*>& vehicles = itr->second.vehicles;
+    std::vector<PxVehicleWheels*>::iterator vitr = std::find(vehicles.begin(), vehicles.end(), vehicle);
+    if (vitr != vehicles.end()) { vehicles.erase(vitr); itr->second.actorListVersion = ~0u; }
+}
+
+void Engine::collectSnapshotActors(PxScene* scene, SnapshotRing& ring)
+{
+    // Frames captured with an older list can't be restored any more
+    ring.actors.clear();
+    ActorMap::iterator itr = _actorMap.find(scene);
+    if (itr != _actorMap.end())
+    {
+        ActorList& actors = itr->second;
+        for (unsigned int i = 0; i < actors.size(); ++i)
+        {
+            PxRigidDynamic* dynamic = actors[i]->is<PxRigidDynamic>();
+            if (dynamic) ring.actors.push_back(dynamic);
+        }
+    }
+    for (unsigned int i = 0; i < ring.frames.size(); ++i) ring.frames[i].valid = false;
+    ring.actorListVersion = _actorListVersions[scene];
+}
+
+bool Engine::takeSnapshot(const std::string& s, unsigned int frameNumber)
+{
+    PxScene* scene = getScene(s);
+    std::map<PxScene*, SnapshotRing>::iterator itr = _snapshots.find(scene);
+    if (itr == _snapshots.end()) return false;
+    endUpdate();
+
+    SnapshotRing& ring = itr->second;
+    if (ring.actorListVersion != _actorListVersions[scene]) collectSnapshotActors(scene, ring);
+
+    SnapshotFrame& frame = ring.frames[ring.nextFrame];
+    ring.nextFrame = (ring.nextFrame + 1) % ring.frames.size();
+    frame.frameNumber = frameNumber;
+    frame.actorListVersion = ring.actorListVersion;
+    frame.valid = true;
+
+    // Resizing keeps the capacity, so this only allocates while the ring is filled for the first time
+    unsigned int numActors = ring.actors.size();
+    frame.poses.resize(numActors); frame.linearVelocities.resize(numActors);
+    frame.angularVelocities.resize(numActors); frame.wakeCounters.resize(numActors);
+    frame.sleeping.resize(numActors);
+    for (unsigned int i = 0; i < numActors; ++i)
+    {
+        PxRigidDynamic* actor = ring.actors[i];
+        frame.poses[i] = actor->getGlobalPose();
+        frame.linearVelocities[i] = actor->getLinearVelocity();
+        frame.angularVelocities[i] = actor->getAngularVelocity();
+        frame.wakeCounters[i] = actor->getWakeCounter();
+        frame.sleeping[i] = actor->isSleeping() ? 1 : 0;
+    }
+
+    unsigned int numWheels = 0;
+    frame.driveData.resize(ring.vehicles.size());
+    for (unsigned int i = 0; i < ring.vehicles.size(); ++i)
+    {
+        PxVehicleWheels* vehicle = ring.vehicles[i];
+        if (vehicle->getVehicleType() != PxVehicleTypes::eNODRIVE)
+            frame.driveData[i] = static_cast<PxVehicleDrive*>(vehicle)->mDriveDynData;
+        numWheels += vehicle->mWheelsSimData.getNbWheels();
+    }
+
+    frame.wheelSpeeds.resize(numWheels); frame.wheelAngles.resize(numWheels);
+    for (unsigned int i = 0, w = 0; i < ring.vehicles.size(); ++i)
+    {
+        const PxVehicleWheelsDynData& wheels = ring.vehicles[i]->mWheelsDynData;
+        for (PxU32 n = 0; n < ring.vehicles[i]->mWheelsSimData.getNbWheels(); ++n, ++w)
+        {
+            frame.wheelSpeeds[w] = wheels.getWheelRotationSpeed(n);
+            frame.wheelAngles[w] = wheels.getWheelRotationAngle(n);
+        }
+    }
+    return true;
+}
+
+bool Engine::restoreSnapshot(const std::string& s, unsigned int frameNumber)
+{
+    PxScene* scene = getScene(s);
+    std::map<PxScene*, SnapshotRing>::iterator itr = _snapshots.find(scene);
+    if (itr == _snapshots.end()) return false;
+    endUpdate();
+
+    SnapshotRing& ring = itr->second;
+    if (ring.actorListVersion != _actorListVersions[scene]) return false;
+
+    SnapshotFrame* frame = NULL;
+    for (unsigned int i = 0; i < ring.frames.size(); ++i)
+    {
+        SnapshotFrame& f = ring.frames[i];
+        if (f.valid && f.frameNumber == frameNumber && f.actorListVersion == ring.actorListVersion)
+        { frame = &f; break; }
+    }
+    if (!frame) return false;
+
+    for (unsigned int i = 0; i < ring.actors.size(); ++i)
+    {
+        PxRigidDynamic* actor = ring.actors[i];
+        actor->setGlobalPose(frame->poses[i], false);
+        if (actor->getRigidBodyFlags() & PxRigidBodyFlag::eKINEMATIC) continue;
+
+        actor->setLinearVelocity(frame->linearVelocities[i], false);
+        actor->setAngularVelocity(frame->angularVelocities[i], false);
+        if (frame->sleeping[i]) actor->putToSleep();
+        else actor->setWakeCounter(frame->wakeCounters[i]);
+    }
+
+    for (unsigned int i = 0, w = 0; i < ring.vehicles.size(); ++i)
+    {
+        PxVehicleWheels* vehicle = ring.vehicles[i];
+        if (vehicle->getVehicleType() != PxVehicleTypes::eNODRIVE)
+            static_cast<PxVehicleDrive*>(vehicle)->mDriveDynData = frame->driveData[i];
+
+        PxVehicleWheelsDynData& wheels = vehicle->mWheelsDynData;
+        for (PxU32 n = 0; n < vehicle->mWheelsSimData.getNbWheels(); ++n, ++w)
+        {
+            wheels.setWheelRotationSpeed(n, frame->wheelSpeeds[w]);
+            wheels.setWheelRotationAngle(n, frame->wheelAngles[w]);
+        }
+    }
     return true;
 }
 
@@ -185,6 +727,21 @@ PxCooking* Engine::getOrCreateCooking(PxCookingParams* params, bool forceCreatin
     return _cooking;
 }
 
+PxDefaultCpuDispatcher* Engine::getOrCreateCpuDispatcher(const std::string& name, unsigned int numThreads)
+{
+    CpuDispatcherMap::iterator itr = _cpuDispatchers.find(name);
+    if (itr != _cpuDispatchers.end()) return itr->second;
+
+    PxDefaultCpuDispatcher* dispatcher = PxDefaultCpuDispatcherCreate(numThreads);
+    if (!dispatcher)
+    {
+        OSG_WARN << "Failed to create Cpu dispatcher " << name << std::endl;
+        return NULL;
+    }
+    _cpuDispatchers[name] = dispatcher;
+    return dispatcher;
+}
+
 PxCudaContextManager* Engine::getOrCreateCudaContextManager(PxCudaContextManagerDesc* desc, bool forceCreating)
 {
     if (forceCreating && _cudaManager)
@@ -209,35 +766,118 @@ PxCudaContextManager* Engine::getOrCreateCudaContextManager(PxCudaContextManager
 
 void Engine::update(double step)
 {
+    beginUpdate(step);
+    endUpdate();
+}
+
+void Engine::beginUpdate(double step)
+{
+    // Results of a previous step must be fetched before simulating again
+    if (_simulating) endUpdate();
+
+    // Kick off all scenes together, so that total step time approaches the slowest scene
     for (SceneMap::iterator itr = _sceneMap.begin(); itr != _sceneMap.end(); ++itr)
     {
-        PxScene* scene = itr->second;
-        scene->simulate(step);
-        while (!scene->fetchResults()) { /* do nothing but wait */ }
+        SceneCompletionTask*& task = _completionTasks[itr->second];
+        if (!task) task = new SceneCompletionTask;
+        task->start();
+        itr->second->simulate(step, task);
+    }
+    _simulating = true;
+}
+
+bool Engine::endUpdate()
+{
+    if (!_simulating) return false;
+    osg::Timer* timer = osg::Timer::instance();
+    for (SceneMap::iterator itr = _sceneMap.begin(); itr != _sceneMap.end(); ++itr)
+    {
+        osg::Timer_t fetchStart = timer->tick();
+        itr->second->fetchResults(true);  // block on the scene's completion event instead of spinning
+        osg::Timer_t fetchEnd = timer->tick();
+
+        SceneTiming& timing = _sceneTimings[itr->first];
+        timing.fetchTime = timer->delta_m(fetchStart, fetchEnd);
+
+        SceneCompletionTask* task = _completionTasks[itr->second];
+        if (task) timing.solverTime = timer->delta_m(task->getStartTick(), task->getEndTick(fetchEnd));
+
+        Profiler* profiler = Profiler::instance();
+        if (profiler->getEnabled())
+        {
+            profiler->addTime(Profiler::SIMULATE, timing.solverTime, itr->second);
+            profiler->addTime(Profiler::FETCH_RESULTS, timing.fetchTime, itr->second);
+            profiler->recordSimulationCounts(itr->second);
+        }
     }
+    _numSimulatedSteps++;
+    _simulating = false;
+    return true;
 }
 
 void Engine::clear()
 {
+    endUpdate();
     for (SceneMap::iterator itr = _sceneMap.begin(); itr != _sceneMap.end(); ++itr)
     {
         PxScene* scene = itr->second;
+        for (unsigned int i = 0; i < _sceneObservers.size(); ++i)
+            _sceneObservers[i]->sceneRemoved(scene);
         releaseActors(scene);
+        releaseSerializedData(scene);
         scene->release();
     }
+
+    for (std::map<PxScene*, SceneCompletionTask*>::iterator itr = _completionTasks.begin();
+         itr != _completionTasks.end(); ++itr) delete itr->second;
+    _completionTasks.clear();
+    _sceneTimings.clear();
+    _interpolationFactors.clear();
+    _snapshots.clear();
+    _actorListVersions.clear();
+
+    // Actor slots are already freed with their generations increased, and scene ids are never reused,
+    // so that handles and ids obtained before clearing stay invalid
+    std::fill(_scenesById.begin(), _scenesById.end(), (PxScene*)NULL);
+    _sceneIds.clear();
     _sceneMap.clear();
     _actorMap.clear();
 }
 
+void Engine::releaseSerializedData(PxScene* scene)
+{
+    SerializedDataMap::iterator itr = _serializedDataMap.find(scene);
+    if (itr == _serializedDataMap.end()) return;
+
+    // Objects must be released before the memory they are deserialized in
+    std::vector<SerializedData>& dataList = itr->second;
+    for (unsigned int i = 0; i < dataList.size(); ++i)
+    {
+        PxCollectionExt::releaseObjects(*dataList[i].collection);
+        dataList[i].collection->release();
+        delete dataList[i].memory;
+    }
+    _serializedDataMap.erase(itr);
+}
+
 void Engine::releaseActors(PxScene* scene)
 {
     ActorMap::iterator itr = _actorMap.find(scene);
     if (itr == _actorMap.end()) return;
 
     ActorList& actors = itr->second;
+    scene->removeActors(&actors[0], actors.size());
     for (unsigned int i = 0; i < actors.size(); ++i)
     {
-        scene->removeActor(*(actors[i]));
+        unsigned int slotIndex = findActorSlot(actors[i]);
+        if (slotIndex == ~0u) continue;
+
+        ActorSlot& slot = _actorSlots[slotIndex];
+        slot.actor->userData = NULL;
+        slot.actor = NULL; slot.scene = NULL; slot.data = NULL;
+        slot.generation++;
+        _freeActorSlots.push_back(slotIndex);
     }
     _actorMap.erase(itr);
+    _actorListVersions[scene]++;
 }
@@ -17,6 +17,9 @@
 namespace osgPhysics
 {
 
+    class SceneCompletionTask;
+    class MappedFileInputData;
+
     /** The engine instance to be used globally */
     class Engine : public osg::Referenced
     {
@@ -34,9 +37,26 @@ namespace osgPhysics
         bool addScene(const std::string& name, physx::PxScene* s);
         bool removeScene(const std::string& name, bool doRelease);
 
+        /** Observer of scenes removed from the engine (or cleared), notified before the scene is released,
+            so that managers could free data kept for it
+        */
+        class SceneObserver
+        {
+        public:
+            virtual ~SceneObserver() {}
+            virtual void sceneRemoved(physx::PxScene* scene) = 0;
+        };
+
+        void addSceneObserver(SceneObserver* observer);
+        void removeSceneObserver(SceneObserver* observer);
+
         physx::PxScene* getScene(const std::string& name);
         const physx::PxScene* getScene(const std::string& name) const;
 
+        /** Get the interned id of a scene, or ~0u if not existing. Use it to avoid string lookups in hot paths */
+        unsigned int getSceneId(const std::string& name) const;
+        physx::PxScene* getScene(unsigned int id) { return id < _scenesById.size() ? _scenesById[id] : NULL; }
+
         typedef std::map<std::string, physx::PxScene*> SceneMap;
         SceneMap& getSceneMap() { return _sceneMap; }
         const SceneMap& getSceneMap() const { return _sceneMap; }
@@ -49,21 +69,137 @@ namespace osgPhysics
 #endif
         bool removeActor(const std::string& scene, physx::PxActor* actor);
 
+        /** Handle of an added actor, which becomes invalid once the actor is removed even if its slot is reused */
+        struct ActorHandle
+        {
+            unsigned int index, generation;
+            ActorHandle() : index(~0u), generation(0) {}
+            bool valid() const { return index != ~0u; }
+        };
+
+        /** Add actor to the scene of the interned id */
+        bool addActor(unsigned int sceneId, physx::PxActor* actor);
+
+        /** Add a number of actors to the scene at once with PxScene::addActors(). Nothing is added if any
+            actor is NULL, repeated or already added
+        */
+        bool addActors(unsigned int sceneId, physx::PxActor* const* actors, unsigned int numActors);
+
+        /** Remove an added actor from its scene in constant time */
+        bool removeActor(physx::PxActor* actor);
+        bool removeActor(ActorHandle handle);
+
+        /** Remove a number of added actors at once with PxScene::removeActors(), returns number of removed ones.
+            Repeated and unknown actors are skipped
+        */
+        unsigned int removeActors(physx::PxActor* const* actors, unsigned int numActors);
+
+        /** Get handle of an added actor, or an invalid handle */
+        ActorHandle getActorHandle(const physx::PxActor* actor) const;
+
+        /** Get actor from the handle, or NULL if it is already removed */
+        physx::PxActor* getActor(ActorHandle handle) const;
+
+        /** Set custom data of an added actor. PxActor::userData is used by the engine to locate added actors,
+            so this should be used instead. The data is cleared when the actor is removed
+        */
+        bool setActorData(physx::PxActor* actor, void* data);
+        void* getActorData(const physx::PxActor* actor) const;
+
         typedef std::vector<physx::PxActor*> ActorList;
         typedef std::map<physx::PxScene*, ActorList> ActorMap;
         ActorMap& getAllActors() { return _actorMap; }
         const ActorMap& getAllActors() const { return _actorMap; }
 
+        /** Save all rigid actors added to the scene, together with their shapes, materials, meshes and height
+            fields, as a PhysX collection. Files with .repx or .xml extension are saved as RepX for debugging
+            and diffing, others are saved as binary for fast loading
+        */
+        bool exportScene(const std::string& scene, const std::string& file);
+
+        /** Register an object with a unique id (> 1, while 1 is the default material), which is referenced by
+            exported collections instead of being duplicated, e.g., materials shared with other systems
+        */
+        void addSharedObject(physx::PxBase& object, physx::PxSerialObjectId id);
+
+        /** Load actors of an exported collection and add them to the scene. Binary files are deserialized in place
+            from a copy-on-write mapping, which is kept until the scene is released together with all loaded objects,
+            so loaded actors should not be released manually
+        */
+        bool importScene(const std::string& scene, const std::string& file);
+
+        /** Set number of frames kept in the snapshot ring of the scene, 0 to disable snapshots. For replaying
+            results as close as possible, create the scene with PxSceneFlag::eENABLE_ENHANCED_DETERMINISM
+        */
+        void setSnapshotCapacity(const std::string& scene, unsigned int numFrames);
+
+        /** Register a vehicle whose drive and wheel states are captured together with snapshots of the scene */
+        void addSnapshotVehicle(const std::string& scene, physx::PxVehicleWheels* vehicle);
+        void removeSnapshotVehicle(const std::string& scene, physx::PxVehicleWheels* vehicle);
+
+        /** Capture poses, velocities and sleep states of all dynamic actors added to the scene, overwriting the oldest
+            frame of the ring. Nothing is allocated once the ring is filled, unless actors are added
+        */
+        bool takeSnapshot(const std::string& scene, unsigned int frameNumber);
+
+        /** Restore the scene to a captured frame. It fails if the frame is not in the ring any more, or actors and
+            vehicles were added or removed since then. Contact caches are not captured, so simulating again
+            after restoring may not be bitwise identical
+        */
+        bool restoreSnapshot(const std::string& scene, unsigned int frameNumber);
+
         /** Get or create a new cooking object */
         physx::PxCooking* getOrCreateCooking(physx::PxCookingParams* params = 0, bool forceCreating = false);
 
+        /** Get or create a named CPU worker pool, which could be passed to createScene() so that
+            each scene (or a group of scenes) is pinned to its own pool. numThreads is only used when creating
+        */
+        physx::PxDefaultCpuDispatcher* getOrCreateCpuDispatcher(const std::string& name, unsigned int numThreads = 1);
+
+        typedef std::map<std::string, physx::PxDefaultCpuDispatcher*> CpuDispatcherMap;
+        const CpuDispatcherMap& getCpuDispatchers() const { return _cpuDispatchers; }
+
         /** Get or create a new CUDA context manager */
         physx::PxCudaContextManager* getOrCreateCudaContextManager(
             physx::PxCudaContextManagerDesc* desc = 0, bool forceCreating = false);
 
-        /** Update the physics system every frame */
+        /** Update the physics system every frame, simulating and fetching results of all scenes */
         void update(double step);
 
+        /** Split-phase update: start simulating all scenes and return immediately */
+        void beginUpdate(double step);
+
+        /** Split-phase update: block until results of the last beginUpdate() are fetched.
+            Returns false if no simulation was started
+        */
+        bool endUpdate();
+
+        /** Check if scenes are still being simulated since last beginUpdate() */
+        bool isSimulating() const { return _simulating; }
+
+        /** Get number of steps whose results were fetched, to find out if poses changed since last check */
+        unsigned int getNumSimulatedSteps() const { return _numSimulatedSteps; }
+
+        /** Set the blending factor [0, 1] between the previous and current simulated poses of a scene for
+            rendering, which is the fraction of a fixed step that is not yet simulated. UpdatePhysicsSystemCallback
+            sets it for every scene, as update() steps all of them. Applications stepping scenes in other ways
+            could set different factors. Default is 1 (current pose only)
+        */
+        void setInterpolationFactor(const physx::PxScene* scene, double f) { _interpolationFactors[scene] = f; }
+        double getInterpolationFactor(const physx::PxScene* scene) const;
+
+        /** Timings of a scene in the last update, in milliseconds */
+        struct SceneTiming
+        {
+            double solverTime;  // from simulate() being called to the scene completing its step
+            double fetchTime;  // time the calling thread was blocked in fetchResults()
+            SceneTiming() : solverTime(0.0), fetchTime(0.0) {}
+        };
+
+        /** Get per-scene timings of the last update, useful for balancing worker pools of scenes */
+        typedef std::map<std::string, SceneTiming> SceneTimingMap;
+        const SceneTimingMap& getSceneTimings() const { return _sceneTimings; }
+
         /** Clear all saved data */
         void clear();
 
@@ -73,14 +209,79 @@ namespace osgPhysics
 
         void releaseActors(physx::PxScene* scene);
 
+        /** Registry entry of an added actor, whose index + 1 is saved in PxActor::userData */
+        struct ActorSlot
+        {
+            physx::PxActor* actor;
+            physx::PxScene* scene;
+            void* data;
+            unsigned int listIndex, generation;
+            ActorSlot() : actor(NULL), scene(NULL), data(NULL), listIndex(0), generation(0) {}
+        };
+
+        unsigned int findActorSlot(const physx::PxActor* actor) const;
+        void registerActor(physx::PxScene* scene, physx::PxActor* actor);
+        void unregisterActor(unsigned int slotIndex);
+
+        std::vector<ActorSlot> _actorSlots;
+        std::vector<unsigned int> _freeActorSlots;
+        std::vector<physx::PxScene*> _scenesById;
+        std::map<std::string, unsigned int> _sceneIds;
+        void releaseSerializedData(physx::PxScene* scene);
+        physx::PxCollection* createSharedCollection();
+
+        struct SerializedData
+        {
+            physx::PxCollection* collection;
+            MappedFileInputData* memory;
+        };
+        typedef std::map<physx::PxScene*, std::vector<SerializedData> > SerializedDataMap;
+        SerializedDataMap _serializedDataMap;
+        std::map<physx::PxSerialObjectId, physx::PxBase*> _sharedObjects;
+
+        /** Scene state of a frame, in separated arrays for each attribute */
+        struct SnapshotFrame
+        {
+            std::vector<physx::PxTransform> poses;
+            std::vector<physx::PxVec3> linearVelocities, angularVelocities;
+            std::vector<physx::PxReal> wakeCounters;
+            std::vector<physx::PxU8> sleeping;
+            std::vector<physx::PxVehicleDriveDynData> driveData;
+            std::vector<physx::PxReal> wheelSpeeds, wheelAngles;
+            unsigned int frameNumber, actorListVersion;
+            bool valid;
+            SnapshotFrame() : frameNumber(0), actorListVersion(0), valid(false) {}
+        };
+
+        struct SnapshotRing
+        {
+            std::vector<SnapshotFrame> frames;
+            std::vector<physx::PxRigidDynamic*> actors;
+            std::vector<physx::PxVehicleWheels*> vehicles;
+            unsigned int nextFrame, actorListVersion;
+            SnapshotRing() : nextFrame(0), actorListVersion(~0u) {}
+        };
+
+        void collectSnapshotActors(physx::PxScene* scene, SnapshotRing& ring);
+        std::map<physx::PxScene*, SnapshotRing> _snapshots;
+        std::map<physx::PxScene*, unsigned int> _actorListVersions;
+
         SceneMap _sceneMap;
         ActorMap _actorMap;
+        CpuDispatcherMap _cpuDispatchers;
+        std::vector<SceneObserver*> _sceneObservers;
+        std::vector<physx::PxActor*> _actorBatch;
+        SceneTimingMap _sceneTimings;
+        std::map<physx::PxScene*, SceneCompletionTask*> _completionTasks;
         physx::PxPhysics* _physicsSDK;
         physx::PxMaterial* _defaultMaterial;
         physx::PxCooking* _cooking;
         physx::PxCudaContextManager* _cudaManager;
         physx::PxPvdTransport* _pvdTransport;
         physx::PxPvd* _pvd;
+        std::map<const physx::PxScene*, double> _interpolationFactors;
+        unsigned int _numSimulatedSteps;
+        bool _simulating;
     };
 
 }
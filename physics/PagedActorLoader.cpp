@@ -0,0 +1,133 @@
+#include <osg/Timer>
+#include <osgDB/DatabasePager>
+#include <osgDB/Registry>
+#include <OpenThreads/ScopedLock>
+#include "PhysicsUtil.h"
+#include "CookingCache.h"
+#include "PagedActorLoader.h"
+
+using namespace osgPhysics;
+using namespace physx;
+
+PagedActorLoader::PagedActorLoader(const std::string& sceneName)
+    : _dispatcher(NULL), _material(NULL), _sceneName(sceneName), _timeBudget(2.0),
+    _verticesPerChunk(65536), _hasFilter(false)
+{
+}
+
+PagedActorLoader::~PagedActorLoader()
+{
+    clear();
+}
+
+void PagedActorLoader::install()
+{
+    osgDB::Registry* registry = osgDB::Registry::instance();
+    if (registry->getReadFileCallback() == this) return;
+    _previousCallback = registry->getReadFileCallback();
+
+    // Create shared objects here, as their lazy creation in pager threads is not thread-safe. Pager threads
+    // never cook with the engine's cooking object, which the update thread may use or recreate at the same time
+    if (!_cookingPool) _cookingPool = new CookingPool(Engine::instance()->getOrCreateCooking()->getParams());
+    CookingCache::instance();
+    registry->setReadFileCallback(this);
+}
+
+void PagedActorLoader::uninstall()
+{
+    osgDB::Registry* registry = osgDB::Registry::instance();
+    if (registry->getReadFileCallback() == this) registry->setReadFileCallback(_previousCallback.get());
+    _previousCallback = NULL;
+}
+
+osgDB::ReaderWriter::ReadResult PagedActorLoader::readNode(const std::string& file, const osgDB::Options* options)
+{
+    osgDB::ReaderWriter::ReadResult result = _previousCallback.valid() ?
+        _previousCallback->readNode(file, options) : osgDB::ReadFileCallback::readNode(file, options);
+    osg::Node* node = result.getNode();
+    if (!node) return result;
+
+    // Only handle nodes of database pager threads, which will be merged to paged LODs later
+    if (!dynamic_cast<osgDB::DatabasePager::DatabaseThread*>(OpenThreads::Thread::CurrentThread())) return result;
+    if (!acceptNode(file, node)) return result;
+
+    PxRigidActor* actor = createTriangleMeshActor(*node, _dispatcher, _material, _verticesPerChunk,
+                                                  _cookingPool.get());
+    if (actor)
+    {
+        TileActor tile; tile.node = node; tile.actor = actor;
+        OpenThreads::ScopedLock<OpenThreads::Mutex> lock(_mutex);
+        _pendingActors.push_back(tile);
+    }
+    return result;
+}
+
+unsigned int PagedActorLoader::getNumPendingActors() const
+{
+    OpenThreads::ScopedLock<OpenThreads::Mutex> lock(_mutex);
+    return _pendingActors.size();
+}
+
+void PagedActorLoader::update()
+{
+    // Remove actors whose tiles are expired and removed from paged LODs
+    for (unsigned int i = 0; i < _activeActors.size();)
+    {
+        osg::ref_ptr<osg::Node> node;
+        TileActor& tile = _activeActors[i];
+        if (tile.node.lock(node) && node->getNumParents() > 0) { ++i; continue; }
+
+        Engine::instance()->removeActor(_sceneName, tile.actor);
+        tile.actor->release();
+        tile = _activeActors.back();
+        _activeActors.pop_back();
+    }
+
+    OpenThreads::ScopedLock<OpenThreads::Mutex> lock(_mutex);
+    osg::Timer_t start = osg::Timer::instance()->tick();
+    unsigned int numInserted = 0;
+    for (std::list<TileActor>::iterator itr = _pendingActors.begin(); itr != _pendingActors.end();)
+    {
+        if (numInserted > 0 && osg::Timer::instance()->delta_m(start, osg::Timer::instance()->tick()) > _timeBudget)
+            break;
+
+        osg::ref_ptr<osg::Node> node;
+        if (!itr->node.lock(node))
+        {
+            // The tile was discarded by the pager before merging
+            itr->actor->release();
+            itr = _pendingActors.erase(itr); continue;
+        }
+        else if (!node->getNumParents()) { ++itr; continue; }
+
+        // Vertices are collected relative to the tile, so apply transforms above it
+        osg::NodePath path = node->getParentalNodePaths()[0]; path.pop_back();
+        osg::Matrix matrix = osg::computeLocalToWorld(path);
+        if (!matrix.isIdentity()) itr->actor->setGlobalPose(PxTransform(toPxMatrix(matrix)));
+
+        bool added = _hasFilter ? Engine::instance()->addActor(_sceneName, itr->actor, _filter)
+                                : Engine::instance()->addActor(_sceneName, itr->actor);
+        if (added) _activeActors.push_back(*itr);
+        else
+        {
+            OSG_WARN << "[PagedActorLoader] Failed to add actor to scene " << _sceneName << std::endl;
+            itr->actor->release();
+        }
+        itr = _pendingActors.erase(itr); numInserted++;
+    }
+}
+
+void PagedActorLoader::clear()
+{
+    for (unsigned int i = 0; i < _activeActors.size(); ++i)
+    {
+        Engine::instance()->removeActor(_sceneName, _activeActors[i].actor);
+        _activeActors[i].actor->release();
+    }
+    _activeActors.clear();
+
+    OpenThreads::ScopedLock<OpenThreads::Mutex> lock(_mutex);
+    for (std::list<TileActor>::iterator itr = _pendingActors.begin(); itr != _pendingActors.end(); ++itr)
+        itr->actor->release();
+    _pendingActors.clear();
+}
@@ -0,0 +1,109 @@
+#ifndef PHYSICS_PAGEDACTORLOADER
+#define PHYSICS_PAGEDACTORLOADER
+
+#include <osg/observer_ptr>
+#include <osg/NodeCallback>
+#include <osgDB/Callbacks>
+#include <OpenThreads/Mutex>
+#include "PhysicsUtil.h"
+#include <list>
+
+namespace osgPhysics
+{
+
+    /** The streaming loader which creates static triangle mesh actors for nodes loaded by the database pager.
+        Collision is cooked in the pager thread right after a tile is read, then actors are inserted into the scene
+        in a bounded time slice of each frame once their tiles are merged, and released when the tiles expire
+    */
+    class PagedActorLoader : public osgDB::ReadFileCallback
+    {
+    public:
+        PagedActorLoader(const std::string& sceneName = "");
+
+        /** Register as the read file callback of the registry, chaining the previous one */
+        void install();
+        void uninstall();
+
+        /** Set the CPU dispatcher to cook chunks of a tile in parallel, NULL to cook in the pager thread only */
+        void setCpuDispatcher(physx::PxCpuDispatcher* d) { _dispatcher = d; }
+        physx::PxCpuDispatcher* getCpuDispatcher() { return _dispatcher; }
+
+        /** Set parameters for cooking tiles, which is done with the loader's own cooking objects as PhysX cooking
+            is only thread-safe per instance. Call it before install(), otherwise parameters of the engine's cooking
+            object at installing are used
+        */
+        void setCookingParams(const physx::PxCookingParams& params) { _cookingPool = new CookingPool(params); }
+        CookingPool* getCookingPool() { return _cookingPool.get(); }
+
+        /** Set max vertex number of each triangle mesh shape, see createTriangleMeshes() */
+        void setVerticesPerChunk(unsigned int n) { _verticesPerChunk = n; }
+        unsigned int getVerticesPerChunk() const { return _verticesPerChunk; }
+
+        /** Set time (in milliseconds) to spend on inserting actors in each frame, at least one is inserted */
+        void setTimeBudget(double ms) { _timeBudget = ms; }
+        double getTimeBudget() const { return _timeBudget; }
+
+        void setMaterial(physx::PxMaterial* mtl) { _material = mtl; }
+        physx::PxMaterial* getMaterial() { return _material; }
+
+        void setFilterData(const physx::PxFilterData& filter) { _filter = filter; _hasFilter = true; }
+        const physx::PxFilterData& getFilterData() const { return _filter; }
+
+        /** Insert actors of merged tiles and remove actors of expired ones, must be called in the update thread */
+        void update();
+
+        /** Remove and release all actors */
+        void clear();
+
+        unsigned int getNumPendingActors() const;
+        unsigned int getNumActiveActors() const { return _activeActors.size(); }
+
+        virtual osgDB::ReaderWriter::ReadResult readNode(const std::string& file, const osgDB::Options* options);
+
+        /** The callback calling update() of the loader, should be applied to the root node */
+        class UpdateCallback : public osg::NodeCallback
+        {
+        public:
+            UpdateCallback(PagedActorLoader* loader) : _loader(loader) {}
+
+            virtual void operator()(osg::Node* node, osg::NodeVisitor* nv)
+            {
+                if (_loader.valid()) _loader->update();
+                traverse(node, nv);
+            }
+
+        protected:
+            osg::observer_ptr<PagedActorLoader> _loader;
+        };
+
+    protected:
+        virtual ~PagedActorLoader();
+
+        /** Decide if an actor should be created for the node read by a pager thread. Override it to skip coarse
+            levels of detail, whose collision would overlap with finer ones
+        */
+        virtual bool acceptNode(const std::string& file, osg::Node* node) { return true; }
+
+        struct TileActor
+        {
+            osg::observer_ptr<osg::Node> node;
+            physx::PxRigidActor* actor;
+        };
+        std::list<TileActor> _pendingActors;
+        std::vector<TileActor> _activeActors;
+        mutable OpenThreads::Mutex _mutex;
+
+        osg::ref_ptr<osgDB::ReadFileCallback> _previousCallback;
+        osg::ref_ptr<CookingPool> _cookingPool;
+        physx::PxCpuDispatcher* _dispatcher;
+        physx::PxMaterial* _material;
+        physx::PxFilterData _filter;
+        std::string _sceneName;
+        double _timeBudget;
+        unsigned int _verticesPerChunk;
+        bool _hasFilter;
+    };
+
+}
+
+#endif
@@ -0,0 +1,125 @@
+#include <osg/Point>
+#include <osg/PointSprite>
+#include "ParticleGeometry.h"
+
+#if !(PX_PHYSICS_VERSION_MAJOR > 3)
+using namespace osgPhysics;
+using namespace physx;
+
+static osg::VertexBufferObject* createStreamBuffer()
+{
+    osg::VertexBufferObject* vbo = new osg::VertexBufferObject;
+    vbo->setUsage(GL_STREAM_DRAW_ARB);
+    return vbo;
+}
+
+ParticleGeometry::ParticleGeometry(ParticleUpdater* updater, int dataAccesses)
+    : osg::Geometry(), _dataAccesses(0)
+{
+    setUseDisplayList(false);
+    setUseVertexBufferObjects(true);
+    setDataVariance(osg::Object::DYNAMIC);
+    setUpdateCallback(new UpdateParticlesCallback);
+    setPointSize(10.0f);
+    setParticleUpdater(updater, dataAccesses);
+}
+
+ParticleGeometry::ParticleGeometry(const ParticleGeometry& copy, const osg::CopyOp& copyop)
+    : osg::Geometry(copy, copyop), _dataAccesses(0)
+{
+    // Vertex arrays are rewritten every frame, so each geometry has its own ones
+    setUpdateCallback(new UpdateParticlesCallback);
+    setParticleUpdater(copy._updater.get(), copy._dataAccesses);
+}
+
+void ParticleGeometry::setParticleUpdater(ParticleUpdater* updater, int dataAccesses)
+{
+    _updater = updater;
+    _dataAccesses = dataAccesses | ParticleUpdater::POSITION_DATA;
+    unsigned int capacity = updater ? updater->getNumParticleAttributes() : 0;
+
+    // Arrays reserve max particles so that resizing them never reallocates. Each one has its own buffer
+    // object starting at offset 0, so that only the particles alive are uploaded after resizing
+    _positions = new osg::Vec3Array;
+    _positions->reserve(capacity);
+    _positions->setVertexBufferObject(createStreamBuffer());
+    setVertexArray(_positions.get());
+
+    _velocities = NULL;
+    if (_dataAccesses & ParticleUpdater::VELOCITY_DATA)
+    {
+        _velocities = new osg::Vec3Array;
+        _velocities->reserve(capacity);
+        _velocities->setVertexBufferObject(createStreamBuffer());
+    }
+    setVertexAttribArray(VELOCITY_ATTRIBUTE, _velocities.get(), osg::Array::BIND_PER_VERTEX);
+
+    _densities = NULL;
+    if (_dataAccesses & ParticleUpdater::DENSITY_DATA)
+    {
+        _densities = new osg::FloatArray;
+        _densities->reserve(capacity);
+        _densities->setVertexBufferObject(createStreamBuffer());
+    }
+    setVertexAttribArray(DENSITY_ATTRIBUTE, _densities.get(), osg::Array::BIND_PER_VERTEX);
+
+    removePrimitiveSet(0, getNumPrimitiveSets());
+    _primitive = new osg::DrawArrays(GL_POINTS, 0, 0);
+    addPrimitiveSet(_primitive.get());
+    dirtyBound();
+}
+
+void ParticleGeometry::setPointSize(float size)
+{
+    osg::StateSet* ss = getOrCreateStateSet();
+    ss->setAttribute(new osg::Point(size));
+    ss->setTextureAttributeAndModes(0, new osg::PointSprite);
+    ss->setMode(GL_LIGHTING, osg::StateAttribute::OFF);
+}
+
+void ParticleGeometry::updateParticles(float dt)
+{
+    if (!_updater || !_updater->getParticleBase()) return;
+
+    // Particles alive never exceed allocated indices, so arrays only grow by particles generated since last frame
+    unsigned int capacity = _updater->getNumParticleAttributes() - _updater->getNumFreeIndices();
+    resizeArrays(capacity);
+    _buffers.capacity = capacity;
+    _buffers.killRemoved = true;
+    _buffers.positions = NULL; _buffers.velocities = NULL; _buffers.densities = NULL;
+    if (capacity > 0)
+    {
+        // osg::Vec3 and PxVec3 are both 3 packed floats, so PhysX could write into the arrays directly
+        _buffers.positions = reinterpret_cast<PxVec3*>(&(*_positions)[0]);
+        if (_velocities.valid()) _buffers.velocities = reinterpret_cast<PxVec3*>(&(*_velocities)[0]);
+        if (_densities.valid()) _buffers.densities = &(*_densities)[0];
+    }
+    _updater->update(dt, _buffers);
+
+    // Shrink arrays to particles written, so that only these are uploaded and drawn
+    resizeArrays(_buffers.numParticles);
+    _positions->dirty();
+    if (_velocities.valid()) _velocities->dirty();
+    if (_densities.valid()) _densities->dirty();
+    _primitive->setCount(_buffers.numParticles);
+    dirtyBound();
+}
+
+void ParticleGeometry::resizeArrays(unsigned int size)
+{
+    _positions->resize(size);
+    if (_velocities.valid()) _velocities->resize(size);
+    if (_densities.valid()) _densities->resize(size);
+}
+
+void ParticleGeometry::UpdateParticlesCallback::update(osg::NodeVisitor* nv, osg::Drawable* drawable)
+{
+    ParticleGeometry* geom = dynamic_cast<ParticleGeometry*>(drawable);
+    const osg::FrameStamp* fs = nv ? nv->getFrameStamp() : NULL;
+    if (!geom || !fs) return;
+
+    double time = fs->getSimulationTime();
+    if (lastTime >= 0.0 && time > lastTime) geom->updateParticles((float)(time - lastTime));
+    lastTime = time;
+}
+#endif
@@ -0,0 +1,70 @@
+#ifndef PHYSICS_PARTICLEGEOMETRY
+#define PHYSICS_PARTICLEGEOMETRY
+
+#include <osg/Geometry>
+#include "ParticleUpdater.h"
+
+#if !(PX_PHYSICS_VERSION_MAJOR > 3)
+namespace osgPhysics
+{
+
+    /** The point-sprite geometry drawing particles of a ParticleUpdater directly, without osgParticle objects.
+        Every frame the updater writes positions (and optionally velocities and densities) straight into vertex
+        arrays of the geometry, which only hold and upload the particles alive. Positions are in world
+        coordinates, so the geometry should not be under any transformed node. Velocities and densities are
+        bound to vertex attributes for shaders, and must also be enabled with ParticleUpdater::setDataAccess().
+        Particles drained or out of life are killed here
+    */
+    class ParticleGeometry : public osg::Geometry
+    {
+    public:
+        enum VertexAttribute
+        {
+            VELOCITY_ATTRIBUTE = 6,
+            DENSITY_ATTRIBUTE = 7
+        };
+
+        ParticleGeometry(ParticleUpdater* updater = NULL,
+                         int dataAccesses = ParticleUpdater::POSITION_DATA);
+        ParticleGeometry(const ParticleGeometry& copy, const osg::CopyOp& copyop = osg::CopyOp::SHALLOW_COPY);
+
+        META_Object(osgPhysics, ParticleGeometry);
+
+        /** Set the updater and kinds of data to draw, which are positions, plus VELOCITY_DATA and DENSITY_DATA */
+        void setParticleUpdater(ParticleUpdater* updater, int dataAccesses = ParticleUpdater::POSITION_DATA);
+        ParticleUpdater* getParticleUpdater() { return _updater.get(); }
+        const ParticleUpdater* getParticleUpdater() const { return _updater.get(); }
+        int getDataAccesses() const { return _dataAccesses; }
+
+        /** Set size of point sprites in pixels */
+        void setPointSize(float size);
+
+        /** Update particles and fill vertex arrays with them, called by the update callback of the geometry */
+        void updateParticles(float dt);
+
+        unsigned int getNumParticles() const { return _positions->size(); }
+
+    protected:
+        virtual ~ParticleGeometry() {}
+
+        struct UpdateParticlesCallback : public osg::Drawable::UpdateCallback
+        {
+            UpdateParticlesCallback() : lastTime(-1.0) {}
+            virtual void update(osg::NodeVisitor* nv, osg::Drawable* drawable);
+            double lastTime;
+        };
+
+        void resizeArrays(unsigned int size);
+
+        osg::ref_ptr<ParticleUpdater> _updater;
+        osg::ref_ptr<osg::Vec3Array> _positions;
+        osg::ref_ptr<osg::Vec3Array> _velocities;
+        osg::ref_ptr<osg::FloatArray> _densities;
+        osg::ref_ptr<osg::DrawArrays> _primitive;
+        ParticleUpdater::ParticleBuffers _buffers;
+        int _dataAccesses;
+    };
+
+}
+#endif
+#endif
@@ -1,26 +1,37 @@
 #include <osg/io_utils>
 #include "PhysicsUtil.h"
 #include "ParticleUpdater.h"
+#include "Profiler.h"
 #include <algorithm>
 #include <iostream>
 
 #if !(PX_PHYSICS_VERSION_MAJOR > 3)
-#include <intrin.h>
-#pragma intrinsic(_BitScanForward)
-#pragma intrinsic(_BitScanReverse)
+#if defined(_MSC_VER)
+#   include <intrin.h>
+#   pragma intrinsic(_BitScanForward)
+#   pragma intrinsic(_BitScanReverse)
+#endif
 
 static unsigned int lowestSetBit(unsigned int index)
 {
+#if defined(_MSC_VER)
     unsigned long value;
     _BitScanForward(&value, index);
     return value;
+#else
+    return __builtin_ctz(index);
+#endif
 }
 
 static unsigned int highestSetBit(unsigned int index)
 {
+#if defined(_MSC_VER)
     unsigned long value;
     _BitScanReverse(&value, index);
     return value;
+#else
+    return 31 - __builtin_clz(index);
+#endif
 }
 
 using namespace osgPhysics;
@@ -29,6 +40,56 @@ using namespace physx;
 #define SDK_OBJ (Engine::instance()->getPhysicsSDK())
 #define DEF_MTL (Engine::instance()->getDefaultMaterial())
 
+/* ParticleIndexPool */
+
+ParticleIndexPool::ParticleIndexPool(PxU32 maxIndices)
+    : _allocated(maxIndices, false)
+{
+    _freeIndices.reserve(maxIndices);
+    freeIndices();
+}
+
+PxU32 ParticleIndexPool::allocateIndices(PxU32 num, const PxStrideIterator<PxU32>& indexBuffer)
+{
+    PxU32 numAllocated = std::min(num, (PxU32)_freeIndices.size());
+    for (PxU32 i = 0; i < numAllocated; ++i)
+    {
+        PxU32 index = _freeIndices.back();
+        _freeIndices.pop_back();
+        _allocated[index] = true;
+        indexBuffer[i] = index;
+    }
+    return numAllocated;
+}
+
+void ParticleIndexPool::freeIndices(PxU32 num, const PxStrideIterator<const PxU32>& indexBuffer)
+{
+    for (PxU32 i = 0; i < num; ++i)
+    {
+        PxU32 index = indexBuffer[i];
+        if (!isAllocated(index)) continue;  // ignore invalid and repeated ones
+        _allocated[index] = false;
+        _freeIndices.push_back(index);
+    }
+}
+
+void ParticleIndexPool::freeIndices()
+{
+    // Push in reverse order so that index 0 is allocated first
+    PxU32 maxIndices = _allocated.size();
+    _freeIndices.resize(maxIndices);
+    for (PxU32 i = 0; i < maxIndices; ++i)
+    {
+        _freeIndices[i] = maxIndices - 1 - i;
+        _allocated[i] = false;
+    }
+}
+
+void ParticleIndexPool::release()
+{
+    delete this;
+}
+
 /* ParticleUpdater::ParticleAttributes */
 
 void ParticleUpdater::ParticleAttributes::setDefaults(unsigned int maxP)
@@ -66,7 +127,7 @@ void ParticleUpdater::ParticleAttributes::setFluidDefaults(unsigned int maxP)
 /* ParticleUpdater */
 
 ParticleUpdater::ParticleUpdater()
-    : _particleSystem(NULL), _indexPool(NULL), _timelessLife(true), _isFluidSystem(false)
+    : _readbackBatchSize(0), _particleSystem(NULL), _indexPool(NULL), _timelessLife(true), _isFluidSystem(false)
 {
     _dataAccesses = POSITION_DATA | FLAGS_DATA;
 }
@@ -117,8 +178,11 @@ bool ParticleUpdater::create(const ParticleAttributes& attr, bool supportRestOff
     }
 
     _particleSystem = SDK_OBJ->createParticleSystem(attr.maxParticles, supportRestOffset);
-    _indexPool = PxParticleExt::createIndexPool(attr.maxParticles);
-    _particleAttributes.resize(attr.maxParticles);
+    _indexPool = new ParticleIndexPool(attr.maxParticles);
+    _particleObjects.assign(attr.maxParticles, (void*)NULL);
+    _particleLifeTimes.assign(attr.maxParticles, 0.0f);
+    _removalBitmap.resize((attr.maxParticles + 31) >> 5);
+    _removedIndices.resize(attr.maxParticles);
     setupAttributes(attr, false);
     return true;
 }
@@ -132,54 +196,85 @@ bool ParticleUpdater::createFluid(const ParticleAttributes& attr, bool supportRe
     }
 
     _particleSystem = SDK_OBJ->createParticleFluid(attr.maxParticles, supportRestOffset);
-    _indexPool = PxParticleExt::createIndexPool(attr.maxParticles);
-    _particleAttributes.resize(attr.maxParticles);
+    _indexPool = new ParticleIndexPool(attr.maxParticles);
+    _particleObjects.assign(attr.maxParticles, (void*)NULL);
+    _particleLifeTimes.assign(attr.maxParticles, 0.0f);
+    _removalBitmap.resize((attr.maxParticles + 31) >> 5);
+    _removedIndices.resize(attr.maxParticles);
     setupAttributes(attr, true);
     return true;
 }
 
+unsigned int ParticleUpdater::allocateIndices(unsigned int num, PxU32* indices)
+{
+    if (!num || !indices || !_indexPool) return 0;
+    return _indexPool->allocateIndices(num, PxStrideIterator<PxU32>(indices));
+}
+
+void ParticleUpdater::freeIndices(unsigned int num, const PxU32* indices)
+{
+    if (!num || !indices || !_indexPool) return;
+    _indexPool->freeIndices(num, PxStrideIterator<const PxU32>(indices));
+}
+
 unsigned int ParticleUpdater::generate(const ParticleData& particles)
 {
     if (!_particleSystem) return 0;
     if (!particles.numParticles || !particles.positions.size())
         return 0;
 
+    PxU32 numParticles = std::min(particles.numParticles, (PxU32)particles.positions.size());
+    const PxU32* indices = NULL;
+    if (particles.indices.empty())
+    {
+        // Only generate as many particles as the index pool could offer
+        if (_generatedIndices.size() < numParticles) _generatedIndices.resize(numParticles);
+        numParticles = allocateIndices(numParticles, &(_generatedIndices[0]));
+        indices = &(_generatedIndices[0]);
+    }
+    else
+    {
+        numParticles = std::min(numParticles, (PxU32)particles.indices.size());
+        indices = &(particles.indices[0]);
+    }
+    if (!numParticles) return 0;
+
     PxParticleCreationData creationData;
-    creationData.numParticles = particles.numParticles;
+    creationData.numParticles = numParticles;
+    creationData.indexBuffer = PxStrideIterator<const PxU32>(indices);
     creationData.positionBuffer = PxStrideIterator<const PxVec3>(&(particles.positions[0]));
-    if (particles.velocities.size() > 0)
+    if (particles.velocities.size() >= numParticles)
         creationData.velocityBuffer = PxStrideIterator<const PxVec3>(&(particles.velocities[0]));
-    if (particles.restOffsets.size() > 0)
+    if (particles.restOffsets.size() >= numParticles)
         creationData.restOffsetBuffer = PxStrideIterator<const PxF32>(&(particles.restOffsets[0]));
-    if (particles.indices.size() > 0)
-        creationData.indexBuffer = PxStrideIterator<const PxU32>(&(particles.indices[0]));
 
     if (particles.lifeTime > 0.0f)
     {
-        for (unsigned int i = 0; i < particles.indices.size(); ++i)
-        {
-            ParticleObjectAttr& attr = _particleAttributes[particles.indices[i]];
-            attr.second = particles.lifeTime;
-        }
+        for (PxU32 i = 0; i < numParticles; ++i)
+            _particleLifeTimes[indices[i]] = particles.lifeTime;
         _timelessLife = false;
     }
     else _timelessLife = true;
 
-    std::vector<physx::PxU32> allocatedIndices(particles.numParticles);
-    PxU32 numIndices = _indexPool->allocateIndices(
-        particles.numParticles, PxStrideIterator<PxU32>(&(allocatedIndices[0])));
     bool ok = _particleSystem->createParticles(creationData);
-    return ok ? numIndices : 0;
+    if (!ok && particles.indices.empty()) freeIndices(numParticles, indices);
+    return ok ? numParticles : 0;
 }
 
 void ParticleUpdater::kill(const std::vector<physx::PxU32>& indices)
 {
-    unsigned int size = indices.size();
-    if (!size || !_particleSystem) return;
+    if (!indices.empty()) kill(indices.size(), &(indices[0]));
+}
+
+void ParticleUpdater::kill(unsigned int size, const physx::PxU32* indices)
+{
+    if (!size || !indices || !_particleSystem) return;
 
-    PxStrideIterator<const PxU32> indexData(&(indices[0]));
+    PxStrideIterator<const PxU32> indexData(indices);
     _particleSystem->releaseParticles(size, indexData);
     _indexPool->freeIndices(size, indexData);
+    for (unsigned int i = 0; i < size; ++i)
+    { if (indices[i] < _particleObjects.size()) _particleObjects[indices[i]] = NULL; }
 }
 
 void ParticleUpdater::killAll()
@@ -187,77 +282,198 @@ void ParticleUpdater::killAll()
     if (!_particleSystem) return;
     _particleSystem->releaseParticles();
     _indexPool->freeIndices();
+    std::fill(_particleObjects.begin(), _particleObjects.end(), (void*)NULL);
 }
 
 void ParticleUpdater::update(float dt, ParticleDataEx* particles)
 {
+    ParticleBuffers buffers;
+    if (!particles)
+    {
+        buffers.killRemoved = true;
+        update(dt, buffers);
+        return;
+    }
+    else if (!_particleSystem)
+    {
+        OSG_NOTICE << "[ParticleUpdater] Particle system is not created" << std::endl;
+        return;
+    }
+
+    ProfileScope profile(Profiler::PARTICLE_READBACK, _particleSystem->getScene());
+    PxParticleReadData* readData = _particleSystem->lockParticleReadData();
+    if (!readData) return;
+
+    // Size the output once from valid particles, and let the readback write into the vectors directly
+    PxU32 size = readData->nbValidParticles;
+    particles->indices.resize(size);
+    particles->positions.resize(readData->positionBuffer.ptr() ? size : 0);
+    particles->velocities.resize(readData->velocityBuffer.ptr() ? size : 0);
+    particles->normals.resize(readData->collisionNormalBuffer.ptr() ? size : 0);
+    particles->restOffsets.resize(readData->restOffsetBuffer.ptr() ? size : 0);
+    particles->densities.resize((_isFluidSystem && _dataAccesses&DENSITY_DATA) ? size : 0);
+    if (size > 0)
+    {
+        buffers.indices = &(particles->indices[0]);
+        if (!particles->positions.empty()) buffers.positions = &(particles->positions[0]);
+        if (!particles->velocities.empty()) buffers.velocities = &(particles->velocities[0]);
+        if (!particles->normals.empty()) buffers.normals = &(particles->normals[0]);
+        if (!particles->restOffsets.empty()) buffers.restOffsets = &(particles->restOffsets[0]);
+        if (!particles->densities.empty()) buffers.densities = &(particles->densities[0]);
+        buffers.capacity = size;
+    }
+    readback(dt, readData, buffers);
+    readData->unlock();
+
+    // Removed particles are not in the output, so shrink vectors to the particles actually written
+    size = buffers.numParticles;
+    particles->numParticles = size;
+    particles->indices.resize(size);
+    if (!particles->positions.empty()) particles->positions.resize(size);
+    if (!particles->velocities.empty()) particles->velocities.resize(size);
+    if (!particles->normals.empty()) particles->normals.resize(size);
+    if (!particles->restOffsets.empty()) particles->restOffsets.resize(size);
+    if (!particles->densities.empty()) particles->densities.resize(size);
+    particles->toRemoveIndices.assign(buffers.removedIndices, buffers.removedIndices + buffers.numRemoved);
+}
+
+void ParticleUpdater::update(float dt, ParticleBuffers& buffers)
+{
+    buffers.numParticles = buffers.numRemoved = 0;
+    buffers.removedIndices = NULL;
     if (!_particleSystem)
     {
         OSG_NOTICE << "[ParticleUpdater] Particle system is not created" << std::endl;
         return;
     }
 
-    std::vector<physx::PxU32> toRemoveList;
+    ProfileScope profile(Profiler::PARTICLE_READBACK, _particleSystem->getScene());
     PxParticleReadData* readData = _particleSystem->lockParticleReadData();
-    if (readData && readData->validParticleRange > 0)
+    if (!readData) return;
+    readback(dt, readData, buffers);
+    readData->unlock();
+
+    // Kill outdated particles
+    if (buffers.killRemoved) kill(buffers.numRemoved, buffers.removedIndices);
+}
+
+void ParticleUpdater::readback(float dt, const PxParticleReadData* readData, ParticleBuffers& buffers)
+{
+    buffers.numParticles = buffers.numRemoved = 0;
+    buffers.removedIndices = NULL;
+    if (!readData->validParticleRange) return;
+
+    PxU32 numWords = ((readData->validParticleRange - 1) >> 5) + 1;
+    if (_removalBitmap.size() < numWords) _removalBitmap.resize(numWords);
+    if (_removedIndices.size() < (numWords << 5)) _removedIndices.resize(numWords << 5);
+
+    PxScene* scene = _particleSystem->getScene();
+    PxCpuDispatcher* dispatcher = scene ? scene->getCpuDispatcher() : NULL;
+    PxU32 wordsPerBatch = numWords;
+    if (_readbackBatchSize > 0 && dispatcher) wordsPerBatch = (_readbackBatchSize + 31) >> 5;
+
+    PxU32 numBatches = (numWords + wordsPerBatch - 1) / wordsPerBatch;
+    _batches.resize(numBatches);
+    _batchJobs.resize(numBatches);
+    for (PxU32 b = 0; b < numBatches; ++b)
     {
-        PxStrideIterator<const PxVec3> positions(readData->positionBuffer);
-        PxStrideIterator<const PxVec3> velocities(readData->velocityBuffer);
-        PxStrideIterator<const PxVec3> collisionNormals(readData->collisionNormalBuffer);
-        PxStrideIterator<const PxF32> restOffsets(readData->restOffsetBuffer);
-        PxStrideIterator<const PxParticleFlags> flags(readData->flagsBuffer);
-
-        PxStrideIterator<const PxF32>* densities = NULL;
-        if (_isFluidSystem && _dataAccesses&DENSITY_DATA)
-        {
-            PxParticleFluidReadData* fluidReadData = static_cast<PxParticleFluidReadData*>(readData);
-            densities = new PxStrideIterator<const PxF32>(fluidReadData->densityBuffer);
-        }
-        if (particles) particles->numParticles = readData->nbValidParticles;
+        ReadbackBatch& batch = _batches[b];
+        batch.updater = this;
+        batch.readData = readData;
+        batch.buffers = &buffers;
+        batch.dt = dt;
+        batch.firstWord = b * wordsPerBatch;
+        batch.lastWord = std::min(batch.firstWord + wordsPerBatch, numWords);
+        batch.counting = true;
+        _batchJobs[b] = &batch;
+    }
+    _batchTasks.run(dispatcher, &(_batchJobs[0]), numBatches);
+
+    // Prefix sum of counts gives where each batch writes, so that the output keeps the order of indices
+    PxU32 numKept = 0, numRemoved = 0;
+    for (PxU32 b = 0; b < numBatches; ++b)
+    {
+        ReadbackBatch& batch = _batches[b];
+        batch.keptOffset = numKept; numKept += batch.numKept;
+        batch.removedOffset = numRemoved; numRemoved += batch.numRemoved;
+        batch.counting = false;
+    }
+    if (numKept > 0 || numRemoved > 0)
+        _batchTasks.run(dispatcher, &(_batchJobs[0]), numBatches);
+
+    buffers.numParticles = std::min(numKept, buffers.capacity);
+    buffers.numRemoved = numRemoved;
+    if (numRemoved > 0) buffers.removedIndices = &(_removedIndices[0]);
+}
 
-        PxU32 bitmapRange = (readData->validParticleRange - 1) >> 5;
-        for (PxU32 w = 0; w <= bitmapRange; ++w)
+void ParticleUpdater::ReadbackBatch::run()
+{
+    if (counting) count();
+    else write();
+}
+
+void ParticleUpdater::ReadbackBatch::count()
+{
+    PxStrideIterator<const PxParticleFlags> flags(readData->flagsBuffer);
+    PxReal* lifeTimes = &(updater->_particleLifeTimes[0]);
+    bool timelessLife = updater->_timelessLife;
+    numKept = numRemoved = 0;
+
+    for (PxU32 w = firstWord; w < lastWord; ++w)
+    {
+        PxU32 removal = 0;
+        for (PxU32 b = readData->validParticleBitmap[w]; b > 0; b &= b - 1)
         {
-            for (PxU32 b = readData->validParticleBitmap[w]; b > 0; b &= b - 1)
+            PxU32 bit = lowestSetBit(b), index = (w << 5 | bit);
+            bool shouldBeRemoved = false;
+
+            // Check if a particle is drained or dead
+            if (flags.ptr() && (flags[index] & PxParticleFlag::eCOLLISION_WITH_DRAIN ||
+                                flags[index] & PxParticleFlag::eSPATIAL_DATA_STRUCTURE_OVERFLOW))
+                shouldBeRemoved = true;
+            else if (!timelessLife)
             {
-                PxU32 index = (w << 5 | lowestSetBit(b));
-                bool shouldBeRemoved = false;
-
-                // Check if a particle is drained or dead
-                if (flags[index] & PxParticleFlag::eCOLLISION_WITH_DRAIN ||
-                    flags[index] & PxParticleFlag::eSPATIAL_DATA_STRUCTURE_OVERFLOW)
-                {
-                    toRemoveList.push_back(index);
-                    shouldBeRemoved = true;
-                }
-                else if (!_timelessLife)
-                {
-                    _particleAttributes[index].second -= dt;
-                    if (_particleAttributes[index].second <= 0.0f)
-                    {
-                        toRemoveList.push_back(index);
-                        shouldBeRemoved = true;
-                    }
-                }
-
-                if (shouldBeRemoved || !particles) continue;
-                particles->indices.push_back(index);
-                if (positions.ptr()) particles->positions.push_back(positions[index]);
-                if (velocities.ptr()) particles->velocities.push_back(velocities[index]);
-                if (collisionNormals.ptr()) particles->normals.push_back(collisionNormals[index]);
-                if (restOffsets.ptr()) particles->restOffsets.push_back(restOffsets[index]);
-                if (densities) particles->densities.push_back((*densities)[index]);
+                lifeTimes[index] -= dt;
+                shouldBeRemoved = lifeTimes[index] <= 0.0f;
             }
+
+            if (shouldBeRemoved) { removal |= (1u << bit); numRemoved++; }
+            else numKept++;
         }
-        if (densities) delete densities;
+        updater->_removalBitmap[w] = removal;
     }
-    readData->unlock();
+}
 
-    // Kill outdated particles
-    if (toRemoveList.size() > 0)
+void ParticleUpdater::ReadbackBatch::write()
+{
+    PxStrideIterator<const PxVec3> positions(readData->positionBuffer);
+    PxStrideIterator<const PxVec3> velocities(readData->velocityBuffer);
+    PxStrideIterator<const PxVec3> collisionNormals(readData->collisionNormalBuffer);
+    PxStrideIterator<const PxF32> restOffsets(readData->restOffsetBuffer);
+    PxStrideIterator<const PxF32> densities;
+    if (updater->_isFluidSystem && updater->_dataAccesses&DENSITY_DATA)
+        densities = static_cast<const PxParticleFluidReadData*>(readData)->densityBuffer;
+
+    ParticleBuffers& out = *buffers;
+    PxU32* removedIndices = &(updater->_removedIndices[0]);
+    PxU32 kept = keptOffset, removed = removedOffset;
+    for (PxU32 w = firstWord; w < lastWord; ++w)
     {
-        if (particles) particles->toRemoveIndices = toRemoveList;
-        else kill(toRemoveList);
+        PxU32 removal = updater->_removalBitmap[w];
+        for (PxU32 b = readData->validParticleBitmap[w]; b > 0; b &= b - 1)
+        {
+            PxU32 bit = lowestSetBit(b), index = (w << 5 | bit);
+            if (removal & (1u << bit)) { removedIndices[removed++] = index; continue; }
+            if (kept >= out.capacity) continue;
+
+            if (out.indices) out.indices[kept] = index;
+            if (out.positions && positions.ptr()) out.positions[kept] = positions[index];
+            if (out.velocities && velocities.ptr()) out.velocities[kept] = velocities[index];
+            if (out.normals && collisionNormals.ptr()) out.normals[kept] = collisionNormals[index];
+            if (out.restOffsets && restOffsets.ptr()) out.restOffsets[kept] = restOffsets[index];
+            if (out.densities && densities.ptr()) out.densities[kept] = densities[index];
+            kept++;
+        }
     }
 }
 
@@ -286,13 +502,7 @@ void ParticleUpdater::setupAttributes(const ParticleAttributes& attr, bool isFlu
 
 unsigned int ParticleUpdater::reuseParticleAttributeIndex() const
 {
-    // FIXME: very foolish method to get unused index
-    for (unsigned int i = 0; i < _particleAttributes.size(); ++i)
-    {
-        if (!_particleAttributes[i].first)
-            return i;
-    }
-    return _particleAttributes.size();
+    return _indexPool ? _indexPool->getNextIndex() : 0;
 }
 
 #ifdef USE_OSGPARTICLE
@@ -306,54 +516,60 @@ NativeParticleEmitter::NativeParticleEmitter(ParticleUpdater* updater)
 
 void NativeParticleEmitter::emitParticles(double dt)
 {
-    ParticleUpdater::ParticleData newParticles;
     if (!_updater)
     {
         osgParticle::ModularEmitter::emitParticles(dt);
         return;
     }
 
-    unsigned int maxParticles = _updater->getNumParticleAttributes();
-    unsigned int aliveParticles = (unsigned int)
-        (getParticleSystem()->numParticles() - getParticleSystem()->numDeadParticles());
-    if (maxParticles <= aliveParticles)
+    int n = getCounter()->numParticlesToCreate(dt);
+    if (n <= 0 || !_updater->getNumFreeIndices())
     {
         // don't generate more particles, the index pool is full
         return;
     }
 
+    // Allocate indices of all new particles at once
+    ParticleUpdater::ParticleData& newParticles = _newParticles;
+    newParticles.indices.resize(n);
+    unsigned int numIndices = _updater->allocateIndices(n, &(newParticles.indices[0]));
+    newParticles.positions.clear();
+    newParticles.velocities.clear();
+    _unusedIndices.clear();
+
     osg::Matrix psToWorld;
     osg::MatrixList worldMats = getParticleSystem()->getWorldMatrices();
     if (!worldMats.empty()) psToWorld = worldMats[0];
 
     //if ( getReferenceFrame()==RELATIVE_RF )  // TODO: how to handle reference frame?
     {
-        int n = getCounter()->numParticlesToCreate(dt);
-        for (int i = 0; i < n; ++i)
+        unsigned int numUsed = 0;
+        for (unsigned int i = 0; i < numIndices; ++i)
         {
+            unsigned int index = newParticles.indices[i];
             osgParticle::Particle* P = getParticleSystem()->createParticle(
                 getUseDefaultTemplate() ? 0 : &getParticleTemplate());
-            if (!P) continue;
+            if (!P)
+            {
+                _unusedIndices.push_back(index);
+                continue;
+            }
 
             getPlacer()->place(P);
             getShooter()->shoot(P);
             P->setLifeTime(_totalLifeTime);
 
-            unsigned int index = _updater->reuseParticleAttributeIndex();
-            if (index >= maxParticles)
-            {
-                P->kill();
-                continue;
-            }
-
             newParticles.positions.push_back(toPxVec3(P->getPosition() * psToWorld));
             newParticles.velocities.push_back(toPxVec3(
                 osg::Matrix::transform3x3(P->getVelocity(), psToWorld)));
-            newParticles.indices.push_back(index);
-            _updater->setParticleObject(index, this);  // FIXME: only to make the index increase
+            newParticles.indices[numUsed++] = index;
+            _updater->setParticleObject(index, this);
         }
+        newParticles.indices.resize(numUsed);
     }
 
+    if (!_unusedIndices.empty())
+        _updater->freeIndices(_unusedIndices.size(), &(_unusedIndices[0]));
     newParticles.numParticles = newParticles.positions.size();
     newParticles.lifeTime = _totalLifeTime;
     _updater->generate(newParticles);
@@ -368,8 +584,8 @@ NativeParticleOperator::NativeParticleOperator(ParticleUpdater* updater)
 
 void NativeParticleOperator::operateParticles(osgParticle::ParticleSystem* ps, double dt)
 {
-    ParticleUpdater::ParticleDataEx particles;
     if (!_updater) return;
+    ParticleUpdater::ParticleDataEx& particles = _particles;
     _updater->update(dt, &particles);
 
     // Update displaying particles
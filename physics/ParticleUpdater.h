@@ -10,11 +10,41 @@
 
 #include <osg/Referenced>
 #include "Engine.h"
+#include "TaskGroup.h"
 
 #if !(PX_PHYSICS_VERSION_MAJOR > 3)
 namespace osgPhysics
 {
 
+    /** The free-list allocator of particle indices, used as the index pool of ParticleUpdater.
+        Allocating and freeing cost O(1) per index, reusing the most recently freed ones first, while freeing
+        all of them costs O(max indices)
+    */
+    class ParticleIndexPool : public physx::PxParticleExt::IndexPool
+    {
+    public:
+        ParticleIndexPool(physx::PxU32 maxIndices);
+
+        virtual physx::PxU32 allocateIndices(physx::PxU32 num,
+                                             const physx::PxStrideIterator<physx::PxU32>& indexBuffer);
+        virtual void freeIndices(physx::PxU32 num, const physx::PxStrideIterator<const physx::PxU32>& indexBuffer);
+        virtual void freeIndices();
+        virtual void release();
+
+        /** Get the index to be allocated next, or getMaxIndices() if the pool is empty */
+        physx::PxU32 getNextIndex() const { return _freeIndices.empty() ? getMaxIndices() : _freeIndices.back(); }
+
+        bool isAllocated(physx::PxU32 i) const { return i < _allocated.size() && _allocated[i]; }
+        physx::PxU32 getNumFreeIndices() const { return _freeIndices.size(); }
+        physx::PxU32 getMaxIndices() const { return _allocated.size(); }
+
+    protected:
+        virtual ~ParticleIndexPool() {}
+
+        std::vector<physx::PxU32> _freeIndices;  // stack of free indices, with capacity of all indices
+        std::vector<bool> _allocated;
+    };
+
     /** The physics based particle updater which provides convenient particle functions */
     class ParticleUpdater : public osg::Referenced
     {
@@ -68,13 +98,38 @@ namespace osgPhysics
             ParticleDataEx() : ParticleData() {}
         };
 
+        /** Caller-provided structure-of-arrays buffers for fetching particles without allocation, see update().
+            Each non-NULL buffer must have room for capacity elements, and NULL buffers are skipped
+        */
+        struct ParticleBuffers
+        {
+            physx::PxU32* indices;
+            physx::PxVec3* positions;
+            physx::PxVec3* velocities;
+            physx::PxVec3* normals;
+            physx::PxF32* restOffsets;
+            physx::PxF32* densities;
+            physx::PxU32 capacity;
+            bool killRemoved;  // kill drained and dead particles in update(), or leave them to the caller
+
+            // Results: particles written (at most capacity) and particles to remove,
+            // whose indices are owned by the updater and valid until next update
+            physx::PxU32 numParticles, numRemoved;
+            const physx::PxU32* removedIndices;
+
+            ParticleBuffers()
+            :   indices(NULL), positions(NULL), velocities(NULL), normals(NULL), restOffsets(NULL),
+                densities(NULL), capacity(0), killRemoved(false), numParticles(0), numRemoved(0),
+                removedIndices(NULL) {}
+        };
+
         ParticleUpdater();
 
         physx::PxParticleBase* getParticleBase() { return _particleSystem; }
         const physx::PxParticleBase* getParticleBase() const { return _particleSystem; }
 
-        physx::PxParticleExt::IndexPool* getIndexPool() { return _indexPool; }
-        const physx::PxParticleExt::IndexPool* getIndexPool() const { return _indexPool; }
+        ParticleIndexPool* getIndexPool() { return _indexPool; }
+        const ParticleIndexPool* getIndexPool() const { return _indexPool; }
 
         enum DataAccess
         {
@@ -100,31 +155,53 @@ namespace osgPhysics
         /** Create a particle fluid system */
         bool createFluid(const ParticleAttributes& attr, bool supportRestOffset = false);
 
-        /** Generate new particles */
+        /** Allocate indices for new particles from the index pool, returns number of indices allocated */
+        unsigned int allocateIndices(unsigned int num, physx::PxU32* indices);
+
+        /** Return allocated indices which are not used by any particles to the index pool */
+        void freeIndices(unsigned int num, const physx::PxU32* indices);
+
+        /** Get number of indices which could still be allocated */
+        unsigned int getNumFreeIndices() const { return _indexPool ? _indexPool->getNumFreeIndices() : 0; }
+
+        /** Generate new particles. Indices are allocated here if particles.indices is empty; otherwise they
+            must come from allocateIndices(). Returns number of particles generated
+        */
         unsigned int generate(const ParticleData& particles);
 
-        /** Kill some particles */
+        /** Kill some particles, freeing their indices and objects */
         void kill(const std::vector<physx::PxU32>& indices);
+        void kill(unsigned int numIndices, const physx::PxU32* indices);
         void killAll();
 
         /** Update particles and fetch result if required
             If particles is set to NULL, deletion of outdated particles will be automatically done;
-            otherwise you will have to manually decide whether to kill them
+            otherwise you will have to manually decide whether to kill them.
+            Vectors of particles are overwritten, and only allocate when they grow over their capacity
         */
         virtual void update(float dt, ParticleDataEx* particles);
 
+        /** Update particles and write them into the caller's buffers. Buffers with capacity of max particles
+            never overflow; otherwise particles over capacity are skipped (but still counted as alive)
+        */
+        virtual void update(float dt, ParticleBuffers& buffers);
+
+        /** Set max number of particles in one batch (> 0) to read back batches in parallel on the scene's CPU
+            dispatcher, or 0 to read all on the calling thread. Batches are split by 32-bit words of the valid
+            particle bitmap, so the size is rounded up to multiples of 32
+        */
+        void setReadbackBatchSize(unsigned int n) { _readbackBatchSize = n; }
+        unsigned int getReadbackBatchSize() const { return _readbackBatchSize; }
+
         /** Set/get specific particle attributes */
-        void setParticleObject(unsigned int i, void* p) { _particleAttributes[i].first = p; }
-        void setParticleLifeTime(unsigned int i, float life) { _particleAttributes[i].second = life; }
+        void setParticleObject(unsigned int i, void* p) { _particleObjects[i] = p; }
+        void setParticleLifeTime(unsigned int i, float life) { _particleLifeTimes[i] = life; }
         void* getParticleObject(unsigned int i, float* life = NULL) const
-        {
-            const ParticleObjectAttr& attr = _particleAttributes[i];
-            if (life) *life = attr.second; return attr.first;
-        }
+        { if (life) *life = _particleLifeTimes[i]; return _particleObjects[i]; }
 
-        /** Get a unused particle attribute for storing information */
+        /** Get the index which allocateIndices() returns next, without allocating it */
         unsigned int reuseParticleAttributeIndex() const;
-        unsigned int getNumParticleAttributes() const { return _particleAttributes.size(); }
+        unsigned int getNumParticleAttributes() const { return _particleObjects.size(); }
 
         /** Get the actor to be added to scene */
         physx::PxParticleBase* getActor() { return _particleSystem; }
@@ -133,12 +210,40 @@ namespace osgPhysics
     protected:
         virtual ~ParticleUpdater();
         void setupAttributes(const ParticleAttributes& attr, bool isFluid);
+        void readback(float dt, const physx::PxParticleReadData* readData, ParticleBuffers& buffers);
 
-        typedef std::pair<void*, physx::PxReal> ParticleObjectAttr;
-        std::vector<ParticleObjectAttr> _particleAttributes;
+        /** Range of bitmap words read back by one task in two passes: counting particles to keep and remove
+            first, and then writing them at offsets from the prefix sum of counts of all batches
+        */
+        struct ReadbackBatch : public TaskGroup::Job
+        {
+            virtual void run();
+            void count();
+            void write();
+
+            ParticleUpdater* updater;
+            const physx::PxParticleReadData* readData;
+            ParticleBuffers* buffers;
+            float dt;
+            physx::PxU32 firstWord, lastWord;
+            physx::PxU32 numKept, numRemoved;
+            physx::PxU32 keptOffset, removedOffset;
+            bool counting;
+        };
+
+        std::vector<void*> _particleObjects;
+        std::vector<physx::PxReal> _particleLifeTimes;
+        std::vector<physx::PxU32> _generatedIndices;
+        std::vector<physx::PxU32> _removalBitmap;  // particles found to remove by the counting pass
+        std::vector<physx::PxU32> _removedIndices;
+
+        std::vector<ReadbackBatch> _batches;
+        std::vector<TaskGroup::Job*> _batchJobs;
+        TaskGroup _batchTasks;
+        unsigned int _readbackBatchSize;
 
         physx::PxParticleBase* _particleSystem;
-        physx::PxParticleExt::IndexPool* _indexPool;
+        ParticleIndexPool* _indexPool;
         int _dataAccesses;
         bool _timelessLife;
         bool _isFluidSystem;
@@ -160,6 +265,9 @@ namespace osgPhysics
 
     protected:
         virtual void emitParticles(double dt);
+
+        ParticleUpdater::ParticleData _newParticles;  // reused every frame
+        std::vector<physx::PxU32> _unusedIndices;
         osg::ref_ptr<ParticleUpdater> _updater;
         float _totalLifeTime;
     };
@@ -182,6 +290,7 @@ namespace osgPhysics
         const ParticleUpdater* getParticleUpdater() const { return _updater.get(); }
 
     protected:
+        ParticleUpdater::ParticleDataEx _particles;  // reused every frame
         osg::ref_ptr<ParticleUpdater> _updater;
     };
 
@@ -0,0 +1,243 @@
+#include "CharacterController.h"
+#include "Vehicle.h"
+#include "PhysicsLODManager.h"
+#include <algorithm>
+
+using namespace osgPhysics;
+using namespace physx;
+
+PhysicsLODManager::PhysicsLODManager()
+    : _hysteresis(10.0), _reducedRateInterval(4), _frameCount(0)
+{
+    _tierDistances[FULL] = 0.0;
+    _tierDistances[REDUCED_RATE] = 100.0;
+    _tierDistances[KINEMATIC] = 250.0;
+    _tierDistances[FROZEN] = 500.0;
+    for (int i = 0; i < NUM_TIERS; ++i) _numAgents[i] = 0;
+}
+
+PhysicsLODManager::~PhysicsLODManager()
+{
+}
+
+void PhysicsLODManager::select(double step, const std::vector<WheeledVehicle*>& vehicles,
+                               const std::vector<CharacterController*>& characters, Selection& selection)
+{
+    selection.raycastVehicles.clear(); selection.raycastResults.clear();
+    selection.cachedVehicles.clear(); selection.cachedResults.clear();
+    selection.characters.clear(); selection.reducedCharacters.clear();
+    selection.numRaycastWheels = 0;
+    for (int i = 0; i < NUM_TIERS; ++i) _numAgents[i] = 0;
+
+    // Vehicles removed from the list directly are made dynamic again, which needs them to be still alive
+    _sortedVehicles.assign(vehicles.begin(), vehicles.end());
+    std::sort(_sortedVehicles.begin(), _sortedVehicles.end());
+    for (unsigned int i = 0; i < _vehicles.size();)
+    {
+        if (std::binary_search(_sortedVehicles.begin(), _sortedVehicles.end(), _vehicles[i])) ++i;
+        else removeVehicle(_vehicles[i]);
+    }
+
+    osg::Vec3d eye = getEyePosition();
+    unsigned int frame = _frameCount++;
+    for (unsigned int i = 0; i < vehicles.size(); ++i)
+    {
+        WheeledVehicle* vehicle = vehicles[i];
+        AgentState& state = getState(_vehicleStates, i, vehicle);
+        PxRigidDynamic* actor = vehicle->getActor();
+        PxTransform pose = actor->getGlobalPose();
+
+        double distance = (osg::Vec3d(pose.p.x, pose.p.y, pose.p.z) - eye).length();
+        setVehicleTier(vehicle, state, computeTier(state.tier, distance));
+        _numAgents[state.tier]++;
+
+        // Reduced-rate vehicles are staggered, so that each frame only casts rays for a part of them
+        bool raycasting = (state.tier == FULL) || (state.tier == REDUCED_RATE &&
+                                                   (frame + i) % _reducedRateInterval == 0);
+        if (raycasting)
+        {
+            selection.raycastVehicles.push_back(vehicle->getDriveEngine());
+            selection.raycastResults.push_back(vehicle->getQueryResult());
+            selection.numRaycastWheels += vehicle->getDriveEngine()->mWheelsSimData.getNbWheels();
+        }
+        else if (state.tier == REDUCED_RATE)
+        {
+            selection.cachedVehicles.push_back(vehicle->getDriveEngine());
+            selection.cachedResults.push_back(vehicle->getQueryResult());
+        }
+    }
+    _vehicleStates.resize(vehicles.size());
+    _vehicles = vehicles;
+
+    for (unsigned int i = 0; i < characters.size(); ++i)
+    {
+        CharacterController* character = characters[i];
+        AgentState& state = getState(_characterStates, i, character);
+        PxExtendedVec3 pos = character->getPosition();
+
+        double distance = (osg::Vec3d(pos.x, pos.y, pos.z) - eye).length();
+        state.tier = computeTier(state.tier, distance);
+        _numAgents[state.tier]++;
+
+        switch (state.tier)
+        {
+        case FULL:
+            selection.characters.push_back(character); break;
+        case REDUCED_RATE:
+            if ((frame + i) % _reducedRateInterval == 0) selection.reducedCharacters.push_back(character);
+            break;
+        case KINEMATIC:
+            {
+                // Follow the offset on the plane of the up direction, as there is no collision to stand on
+                const osg::Vec3& offset = character->getMoveOffset();
+                PxVec3 move(offset[0], offset[1], offset[2]);
+                PxVec3 up = character->getController()->getUpDirection();
+                move -= up * move.dot(up);
+                pos.x += move.x; pos.y += move.y; pos.z += move.z;
+                character->setPosition(pos);
+            }
+            break;
+        default: break;
+        }
+    }
+    _characterStates.resize(characters.size());
+}
+
+void PhysicsLODManager::updateKinematicVehicles(double dt)
+{
+    if (dt <= 0.0) return;
+    for (unsigned int i = 0; i < _vehicleStates.size() && i < _vehicles.size(); ++i)
+    {
+        AgentState& state = _vehicleStates[i];
+        if (state.tier != KINEMATIC) continue;
+
+        // The kinematic target of last step has been reached, so move on from the current pose
+        PxRigidDynamic* actor = _vehicles[i]->getActor();
+        PxTransform pose = actor->getGlobalPose();
+        PxVec3 up = -actor->getScene()->getGravity();
+        if (up.normalize() <= 0.0f) up = PxVec3(0.0f, 0.0f, 1.0f);
+        computeKinematicPose(_vehicles[i], dt, up, state.linearVelocity, state.angularVelocity, pose);
+        actor->setKinematicTarget(pose);
+    }
+}
+
+PhysicsLODManager::Tier PhysicsLODManager::getVehicleTier(const WheeledVehicle* vehicle) const
+{
+    for (unsigned int i = 0; i < _vehicleStates.size(); ++i)
+    { if (_vehicleStates[i].agent == vehicle) return _vehicleStates[i].tier; }
+    return FULL;
+}
+
+PhysicsLODManager::Tier PhysicsLODManager::getCharacterTier(const CharacterController* character) const
+{
+    for (unsigned int i = 0; i < _characterStates.size(); ++i)
+    { if (_characterStates[i].agent == character) return _characterStates[i].tier; }
+    return FULL;
+}
+
+void PhysicsLODManager::removeVehicle(WheeledVehicle* vehicle)
+{
+    // States and vehicles are at the same indices after select()
+    std::vector<WheeledVehicle*>::iterator itr = std::find(_vehicles.begin(), _vehicles.end(), vehicle);
+    if (itr != _vehicles.end()) _vehicles.erase(itr);
+    for (unsigned int i = 0; i < _vehicleStates.size(); ++i)
+    {
+        if (_vehicleStates[i].agent != vehicle) continue;
+        setVehicleTier(vehicle, _vehicleStates[i], FULL);
+        _vehicleStates.erase(_vehicleStates.begin() + i); break;
+    }
+}
+
+void PhysicsLODManager::removeCharacter(CharacterController* character)
+{
+    for (unsigned int i = 0; i < _characterStates.size(); ++i)
+    {
+        if (_characterStates[i].agent != character) continue;
+        _characterStates.erase(_characterStates.begin() + i); break;
+    }
+}
+
+void PhysicsLODManager::reset()
+{
+    for (unsigned int i = 0; i < _vehicleStates.size() && i < _vehicles.size(); ++i)
+        setVehicleTier(_vehicles[i], _vehicleStates[i], FULL);
+    _vehicleStates.clear(); _characterStates.clear(); _vehicles.clear();
+    for (int i = 0; i < NUM_TIERS; ++i) _numAgents[i] = 0;
+}
+
+void PhysicsLODManager::computeKinematicPose(WheeledVehicle* vehicle, double step, const PxVec3& up,
+                                             PxVec3& linearVelocity, PxVec3& angularVelocity, PxTransform& pose)
+{
+    // Dead reckoning on the horizontal plane, turning the heading with the yaw rate
+    PxVec3 velocity = linearVelocity - up * linearVelocity.dot(up);
+    PxReal yawRate = angularVelocity.dot(up);
+    PxQuat yaw(yawRate * (PxReal)step, up);
+
+    pose.p += velocity * (PxReal)step;
+    pose.q = (yaw * pose.q).getNormalized();
+    linearVelocity = yaw.rotate(linearVelocity);
+    angularVelocity = up * yawRate;
+}
+
+PhysicsLODManager::Tier PhysicsLODManager::computeTier(Tier current, double distance) const
+{
+    int tier = current;
+    while (tier + 1 < NUM_TIERS && distance > _tierDistances[tier + 1] + _hysteresis) tier++;
+    while (tier > FULL && distance < _tierDistances[tier] - _hysteresis) tier--;
+    return (Tier)tier;
+}
+
+PhysicsLODManager::AgentState& PhysicsLODManager::getState(std::vector<AgentState>& states, unsigned int index,
+                                                           const void* agent)
+{
+    if (index < states.size() && states[index].agent == agent) return states[index];
+
+    // The agent list of the updater changed, find the state of the agent or insert a new one
+    if (index >= states.size()) states.resize(index + 1);
+    for (unsigned int i = index + 1; i < states.size(); ++i)
+    {
+        if (states[i].agent != agent) continue;
+        std::swap(states[index], states[i]);
+        return states[index];
+    }
+
+    AgentState newState, oldState = states[index]; newState.agent = agent;
+    if (oldState.agent) states.push_back(oldState);  // keep it for later agents to find
+    states[index] = newState;
+    return states[index];
+}
+
+void PhysicsLODManager::setVehicleTier(WheeledVehicle* vehicle, AgentState& state, Tier tier)
+{
+    if (state.tier == tier) return;
+    PxRigidDynamic* actor = vehicle->getActor();
+    bool wasDynamic = (state.tier <= REDUCED_RATE), dynamic = (tier <= REDUCED_RATE);
+    if (wasDynamic && !dynamic)
+    {
+        // Velocities are kept for the kinematic path and for restoring later
+        state.linearVelocity = actor->getLinearVelocity();
+        state.angularVelocity = actor->getAngularVelocity();
+        actor->setRigidBodyFlag(PxRigidBodyFlag::eKINEMATIC, true);
+    }
+
+    if (tier == FROZEN)
+        actor->setActorFlag(PxActorFlag::eDISABLE_SIMULATION, true);
+    else if (state.tier == FROZEN)
+        actor->setActorFlag(PxActorFlag::eDISABLE_SIMULATION, false);
+
+    if (!wasDynamic && dynamic)
+    {
+        actor->setRigidBodyFlag(PxRigidBodyFlag::eKINEMATIC, false);
+        actor->setLinearVelocity(state.linearVelocity);
+        actor->setAngularVelocity(state.angularVelocity);
+        actor->wakeUp();
+    }
+    state.tier = tier;
+}
+
+osg::Vec3d PhysicsLODManager::getEyePosition() const
+{
+    osg::ref_ptr<osg::Camera> camera;
+    if (_camera.lock(camera)) return osg::Vec3d() * camera->getInverseViewMatrix();
+    return _referencePosition;
+}
@@ -0,0 +1,126 @@
+#ifndef PHYSICS_PHYSICSLODMANAGER
+#define PHYSICS_PHYSICSLODMANAGER
+
+#include <osg/observer_ptr>
+#include <osg/Camera>
+#include "Engine.h"
+
+namespace osgPhysics
+{
+
+    class CharacterController;
+    class WheeledVehicle;
+
+    /** The level-of-detail manager selecting how vehicles and characters of an UpdatePhysicsSystemCallback are
+        simulated from their distances to the camera (or a reference position). Tiers are:
+        - FULL: updated every step as usual
+        - REDUCED_RATE: vehicles only cast suspension rays every few frames and reuse cached contacts in between,
+          while characters are moved every few frames with the offsets of all these frames
+        - KINEMATIC: vehicles become kinematic and follow computeKinematicPose(), characters are moved without
+          collisions horizontally
+        - FROZEN: agents are not updated, and vehicles have simulation disabled
+        Velocities are saved when a vehicle leaves the dynamic tiers and restored when it comes back, while its
+        drive data (gear, engine and wheel rotation speeds) are never touched
+    */
+    class PhysicsLODManager : public osg::Referenced
+    {
+    public:
+        enum Tier { FULL = 0, REDUCED_RATE, KINEMATIC, FROZEN, NUM_TIERS };
+
+        PhysicsLODManager();
+
+        /** Set the camera whose eye point is the reference position, or NULL to use setReferencePosition() */
+        void setCamera(osg::Camera* camera) { _camera = camera; }
+        osg::Camera* getCamera() { return _camera.get(); }
+
+        /** Set the reference position (e.g., of the player), which is only used when no camera is set */
+        void setReferencePosition(const osg::Vec3d& pos) { _referencePosition = pos; }
+        const osg::Vec3d& getReferencePosition() const { return _referencePosition; }
+
+        /** Set distance beyond which agents enter the tier (> FULL), should increase with tiers */
+        void setTierDistance(Tier t, double d) { if (t > FULL && t < NUM_TIERS) _tierDistances[t] = d; }
+        double getTierDistance(Tier t) const { return (t > FULL && t < NUM_TIERS) ? _tierDistances[t] : 0.0; }
+
+        /** Set width of the hysteresis band around each tier distance, so that agents moving near it do not
+            switch tiers every frame: they only move to a coarser tier beyond (distance + width) and back to
+            the finer one within (distance - width)
+        */
+        void setHysteresis(double width) { _hysteresis = width; }
+        double getHysteresis() const { return _hysteresis; }
+
+        /** Set number of frames between updates of REDUCED_RATE agents, which are staggered over these frames */
+        void setReducedRateInterval(unsigned int n) { _reducedRateInterval = n > 0 ? n : 1; }
+        unsigned int getReducedRateInterval() const { return _reducedRateInterval; }
+
+        /** Agents selected to be updated in current frame, see select() */
+        struct Selection
+        {
+            std::vector<physx::PxVehicleWheels*> raycastVehicles, cachedVehicles;
+            std::vector<physx::PxVehicleWheelQueryResult> raycastResults, cachedResults;
+            std::vector<CharacterController*> characters, reducedCharacters;
+            unsigned int numRaycastWheels;
+        };
+
+        /** Select tiers of all agents and apply transitions, then move kinematic characters and fill the selection
+            with vehicles to be updated with and without raycasts in each step, and characters to be moved in this
+            frame. Vehicles missing from the list since last call are returned to the FULL tier and forgotten.
+            Called by UpdatePhysicsSystemCallback once per frame before simulating
+        */
+        virtual void select(double step, const std::vector<WheeledVehicle*>& vehicles,
+                            const std::vector<CharacterController*>& characters, Selection& selection);
+
+        /** Set kinematic targets of KINEMATIC vehicles for the next simulated step. Called by
+            UpdatePhysicsSystemCallback before each step, so that their speed is independent of frame rate
+        */
+        virtual void updateKinematicVehicles(double dt);
+
+        Tier getVehicleTier(const WheeledVehicle* vehicle) const;
+        Tier getCharacterTier(const CharacterController* character) const;
+
+        /** Get number of agents of each tier in the last frame */
+        unsigned int getNumAgents(Tier t) const { return (t < NUM_TIERS) ? _numAgents[t] : 0; }
+
+        /** Return the vehicle to the FULL tier and forget it, called when it is removed from the updater */
+        void removeVehicle(WheeledVehicle* vehicle);
+        void removeCharacter(CharacterController* character);
+
+        /** Return all vehicles to the FULL tier and forget all agents */
+        void reset();
+
+    protected:
+        virtual ~PhysicsLODManager();
+
+        struct AgentState
+        {
+            const void* agent;
+            Tier tier;
+            physx::PxVec3 linearVelocity, angularVelocity;  // saved when leaving dynamic tiers
+            AgentState() : agent(NULL), tier(FULL) {}
+        };
+
+        /** Compute next pose of a KINEMATIC vehicle. The default one keeps its last heading and turning rate on
+            the horizontal plane. Override it to follow roads or recorded paths, and change the velocities which
+            are restored when the vehicle becomes dynamic again
+        */
+        virtual void computeKinematicPose(WheeledVehicle* vehicle, double step, const physx::PxVec3& up,
+                                          physx::PxVec3& linearVelocity, physx::PxVec3& angularVelocity,
+                                          physx::PxTransform& pose);
+
+        Tier computeTier(Tier current, double distance) const;
+        AgentState& getState(std::vector<AgentState>& states, unsigned int index, const void* agent);
+        void setVehicleTier(WheeledVehicle* vehicle, AgentState& state, Tier tier);
+        osg::Vec3d getEyePosition() const;
+
+        osg::observer_ptr<osg::Camera> _camera;
+        osg::Vec3d _referencePosition;
+        std::vector<AgentState> _vehicleStates, _characterStates;
+        std::vector<WheeledVehicle*> _vehicles, _sortedVehicles;
+        double _tierDistances[NUM_TIERS];
+        double _hysteresis;
+        unsigned int _numAgents[NUM_TIERS];
+        unsigned int _reducedRateInterval, _frameCount;
+    };
+
+}
+
+#endif
@@ -1,11 +1,36 @@
 #include <osg/io_utils>
 #include <osg/TriangleFunctor>
 #include <osg/MatrixTransform>
+#include <OpenThreads/ScopedLock>
 #include "PhysicsUtil.h"
+#include "CookingCache.h"
+#include "TaskGroup.h"
 #include "Vehicle.h"
 #include "CharacterController.h"
 #include <algorithm>
+#include <fstream>
 #include <iostream>
+#include <sys/stat.h>
+
+#ifdef WIN32
+#   ifndef NOMINMAX
+#       define NOMINMAX
+#   endif
+#   include <windows.h>
+#else
+#   include <sys/mman.h>
+#   include <fcntl.h>
+#   include <unistd.h>
+#endif
+
+#if !defined(OSG_USE_FLOAT_MATRIX) && (defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2))
+#   define OSGPHYSICS_USE_SSE2
+#   include <emmintrin.h>
+#   if defined(__AVX__)
+#       define OSGPHYSICS_USE_AVX
+#       include <immintrin.h>
+#   endif
+#endif
 
 using namespace physx;
 using namespace osgPhysics;
@@ -31,16 +56,13 @@ struct CollectFaceOperator
 
     unsigned int getOrCreateVertex(const osg::Vec3& p)
     {
-        unsigned int index = 0;
-        if (collector->vertexMap.find(p) == collector->vertexMap.end())
+        bool inserted = false;
+        unsigned int index = collector->vertexMap.insertOrGet(p, collector->vertices.size(), inserted);
+        if (inserted)
         {
-            index = collector->vertexMap.size();
-            collector->vertexMap[p] = index;
             collector->vertices.push_back(p);
             collector->bound.expandBy(p);
         }
-        else
-            index = collector->vertexMap[p];
         return index;
     }
 
@@ -48,8 +70,101 @@ struct CollectFaceOperator
     osg::Matrix matrix;
 };
 
-GeometryDataCollector::GeometryDataCollector()
-    : osg::NodeVisitor(osg::NodeVisitor::TRAVERSE_ALL_CHILDREN), numTotalVertices(0)
+VertexHashMap::VertexHashMap(float epsilon)
+    : _size(0), _mask(0), _epsilon(0.0f), _invEpsilon(0.0f)
+{
+    setEpsilon(epsilon);
+}
+
+void VertexHashMap::setEpsilon(float epsilon)
+{
+    _epsilon = epsilon > 0.0f ? epsilon : 0.0f;
+    _invEpsilon = epsilon > 0.0f ? 1.0f / epsilon : 0.0f;
+    clear();
+}
+
+void VertexHashMap::makeKey(const osg::Vec3& v, PxI64* key) const
+{
+    if (_epsilon > 0.0f)
+    {
+        // Quantize in double precision to 64-bit cells, clamped so that huge (or NaN) coordinates never overflow
+        const double limit = 4.0e18;
+        for (int i = 0; i < 3; ++i)
+        {
+            double cell = floor((double)v[i] * (double)_invEpsilon);
+            key[i] = (cell == cell) ? (PxI64)osg::clampBetween(cell, -limit, limit) : 0;
+        }
+    }
+    else
+    {
+        // Adding zero turns -0 into +0, so that they are equal like with operator<
+        for (int i = 0; i < 3; ++i)
+        { float f = v[i] + 0.0f; PxI32 bits; memcpy(&bits, &f, sizeof(float)); key[i] = bits; }
+    }
+}
+
+static inline unsigned int hashVertexKey(const PxI64* key)
+{
+    PxU64 h = (PxU64)key[0] * 0x9e3779b97f4a7c15ULL ^ (PxU64)key[1] * 0xc2b2ae3d27d4eb4fULL
+            ^ (PxU64)key[2] * 0x165667b19e3779f9ULL;
+    h ^= h >> 33; h *= 0xff51afd7ed558ccdULL; h ^= h >> 33;
+    return (unsigned int)h;
+}
+
+void VertexHashMap::reserve(unsigned int numVertices)
+{
+    // Keep load factor under 0.5 for short probe sequences
+    unsigned int capacity = 16;
+    while (capacity < numVertices * 2) capacity <<= 1;
+    if (capacity > _entries.size()) rehash(capacity);
+}
+
+unsigned int VertexHashMap::insertOrGet(const osg::Vec3& v, unsigned int newIndex, bool& inserted)
+{
+    if ((_size + 1) * 2 > _entries.size()) rehash(_entries.empty() ? 16 : _entries.size() * 2);
+
+    PxI64 key[3]; makeKey(v, key);
+    unsigned int slot = hashVertexKey(key) & _mask;
+    while (true)
+    {
+        Entry& entry = _entries[slot];
+        if (entry.index == ~0u)
+        {
+            entry.key[0] = key[0]; entry.key[1] = key[1]; entry.key[2] = key[2];
+            entry.index = newIndex; _size++;
+            inserted = true; return newIndex;
+        }
+        else if (entry.key[0] == key[0] && entry.key[1] == key[1] && entry.key[2] == key[2])
+        { inserted = false; return entry.index; }
+        slot = (slot + 1) & _mask;
+    }
+}
+
+void VertexHashMap::clear()
+{
+    _entries.clear(); _size = 0; _mask = 0;
+}
+
+void VertexHashMap::rehash(unsigned int capacity)
+{
+    std::vector<Entry> oldEntries(capacity);
+    oldEntries.swap(_entries);
+    for (unsigned int i = 0; i < capacity; ++i) _entries[i].index = ~0u;
+    _mask = capacity - 1;
+
+    for (unsigned int i = 0; i < oldEntries.size(); ++i)
+    {
+        const Entry& entry = oldEntries[i];
+        if (entry.index == ~0u) continue;
+
+        unsigned int slot = hashVertexKey(entry.key) & _mask;
+        while (_entries[slot].index != ~0u) slot = (slot + 1) & _mask;
+        _entries[slot] = entry;
+    }
+}
+
+GeometryDataCollector::GeometryDataCollector(float weldEpsilon)
+    : osg::NodeVisitor(osg::NodeVisitor::TRAVERSE_ALL_CHILDREN), vertexMap(weldEpsilon), numTotalVertices(0)
 {}
 
 void GeometryDataCollector::apply(osg::Transform& transform)
@@ -75,6 +190,7 @@ void GeometryDataCollector::apply(osg::Geode& node)
         {
             osg::Vec3Array* va = dynamic_cast<osg::Vec3Array*>(geom->getVertexArray());
             numTotalVertices += (va ? va->size() : 0);
+            vertexMap.reserve(numTotalVertices);
 
             osg::TriangleFunctor<CollectFaceOperator> functor;
             functor.collector = this;
@@ -92,37 +208,301 @@ void GeometryDataCollector::apply(osg::Geode& node)
     traverse(node);
 }
 
-MemoryOutputStream::MemoryOutputStream()
-    : _data(NULL), _size(0), _capacity(0)
+/* Parallel geometry collection */
+
+struct GeodeChunk
+{
+    typedef std::pair<osg::ref_ptr<osg::Geode>, osg::Matrix> GeodeAndMatrix;
+    std::vector<GeodeAndMatrix> geodes;
+    unsigned int numVertices;
+    GeodeChunk() : numVertices(0) {}
+};
+
+/** Partition the subgraph into chunks of geodes with their world matrices, each of about the max vertex number */
+struct GeodePartitioner : public osg::NodeVisitor
+{
+    GeodePartitioner(unsigned int maxVertices)
+        : osg::NodeVisitor(osg::NodeVisitor::TRAVERSE_ALL_CHILDREN), verticesPerChunk(maxVertices) {}
+
+    virtual void apply(osg::Transform& transform)
+    {
+        osg::Matrix matrix;
+        if (!matrixStack.empty()) matrix = matrixStack.back();
+        transform.computeLocalToWorldMatrix(matrix, this);
+
+        matrixStack.push_back(matrix);
+        traverse(transform);
+        matrixStack.pop_back();
+    }
+
+    virtual void apply(osg::Geode& node)
+    {
+        unsigned int numVertices = 0;
+        for (unsigned int i = 0; i < node.getNumDrawables(); ++i)
+        {
+            osg::Geometry* geom = node.getDrawable(i)->asGeometry();
+            osg::Array* va = geom ? geom->getVertexArray() : NULL;
+            numVertices += (va ? va->getNumElements() : 0);
+        }
+
+        if (chunks.empty() || (chunks.back().numVertices > 0 &&
+            chunks.back().numVertices + numVertices > verticesPerChunk)) chunks.push_back(GeodeChunk());
+        chunks.back().geodes.push_back(GeodeChunk::GeodeAndMatrix(
+            &node, matrixStack.empty() ? osg::Matrix() : matrixStack.back()));
+        chunks.back().numVertices += numVertices;
+    }
+
+    std::vector<GeodeChunk> chunks;
+    std::vector<osg::Matrix> matrixStack;
+    unsigned int verticesPerChunk;
+};
+
+static void getCollectedData(const GeometryDataCollector& collector, std::vector<PxVec3>& verts,
+                             std::vector<PxU32>& indices)
+{
+    verts.resize(collector.vertices.size());
+    for (unsigned int i = 0; i < collector.vertices.size(); ++i)
+    {
+        const osg::Vec3& v = collector.vertices[i];
+        verts[i] = PxVec3(v[0], v[1], v[2]);
+    }
+
+    indices.resize(collector.faces.size() * 3);
+    for (unsigned int i = 0; i < collector.faces.size(); ++i)
+    {
+        const GeometryDataCollector::GeometryFace& f = collector.faces[i];
+        indices[i * 3 + 0] = f.indices[0];
+        indices[i * 3 + 1] = f.indices[1];
+        indices[i * 3 + 2] = f.indices[2];
+    }
+}
+
+/** Collect and weld geometry data of a chunk, and optionally cook it with a cooking object of the pool */
+class CollectChunkJob : public TaskGroup::Job
+{
+public:
+    CollectChunkJob(const GeodeChunk& c, CookingPool* pool) : _chunk(c), _mesh(NULL), _pool(pool) {}
+
+    virtual void run()
+    {
+        GeometryDataCollector collector;
+        for (unsigned int i = 0; i < _chunk.geodes.size(); ++i)
+        {
+            collector.pushMatrix(_chunk.geodes[i].second);
+            _chunk.geodes[i].first->accept(collector);
+            collector.popMatrix();
+        }
+
+        getCollectedData(collector, verts, indices);
+        if (_pool && !verts.empty() && !indices.empty())
+        {
+            PxCooking* cooking = _pool->acquire();
+            if (cooking) _mesh = osgPhysics::createTriangleMesh(verts, indices, cooking);
+            _pool->release(cooking);
+        }
+    }
+
+    PxTriangleMesh* getMesh() const { return _mesh; }
+    std::vector<PxVec3> verts;
+    std::vector<PxU32> indices;
+
+protected:
+    const GeodeChunk& _chunk;
+    PxTriangleMesh* _mesh;
+    CookingPool* _pool;
+};
+
+static void runCollectChunkJobs(osg::Node& node, PxCpuDispatcher* dispatcher, unsigned int verticesPerChunk,
+                                CookingPool* pool, std::vector<GeodeChunk>& chunks,
+                                std::vector<CollectChunkJob*>& jobs)
 {
+    GeodePartitioner partitioner(verticesPerChunk);
+    node.accept(partitioner);
+    chunks.swap(partitioner.chunks);
+
+    std::vector<TaskGroup::Job*> jobList;
+    for (unsigned int i = 0; i < chunks.size(); ++i)
+    {
+        jobs.push_back(new CollectChunkJob(chunks[i], pool));
+        jobList.push_back(jobs.back());
+    }
+
+    TaskGroup group;
+    if (!jobList.empty()) group.run(dispatcher, &jobList[0], jobList.size());
+}
+
+/** Collect geometry data of the subgraph, in parallel chunks which are then merged if a dispatcher is set */
+static void collectGeometryData(osg::Node& node, PxCpuDispatcher* dispatcher, unsigned int verticesPerChunk,
+                                bool weld, std::vector<PxVec3>& verts, std::vector<PxU32>& indices)
+{
+    if (!dispatcher)
+    {
+        GeometryDataCollector collector;
+        node.accept(collector);
+        getCollectedData(collector, verts, indices);
+        return;
+    }
+
+    std::vector<GeodeChunk> chunks;
+    std::vector<CollectChunkJob*> jobs;
+    runCollectChunkJobs(node, dispatcher, verticesPerChunk, NULL, chunks, jobs);
+
+    unsigned int numVertices = 0, numIndices = 0;
+    for (unsigned int i = 0; i < jobs.size(); ++i)
+    { numVertices += jobs[i]->verts.size(); numIndices += jobs[i]->indices.size(); }
+
+    // Only unique vertices of each chunk are welded here, which is much cheaper than collecting
+    VertexHashMap vertexMap; vertexMap.reserve(weld ? numVertices : 0);
+    std::vector<PxU32> remapping;
+    verts.reserve(numVertices); indices.reserve(numIndices);
+    for (unsigned int i = 0; i < jobs.size(); ++i)
+    {
+        const std::vector<PxVec3>& chunkVerts = jobs[i]->verts;
+        remapping.resize(chunkVerts.size());
+        for (unsigned int v = 0; v < chunkVerts.size(); ++v)
+        {
+            bool inserted = true;
+            if (weld)
+            {
+                const PxVec3& p = chunkVerts[v];
+                remapping[v] = vertexMap.insertOrGet(osg::Vec3(p.x, p.y, p.z), verts.size(), inserted);
+            }
+            else remapping[v] = verts.size();
+            if (inserted) verts.push_back(chunkVerts[v]);
+        }
+
+        const std::vector<PxU32>& chunkIndices = jobs[i]->indices;
+        for (unsigned int n = 0; n < chunkIndices.size(); ++n) indices.push_back(remapping[chunkIndices[n]]);
+        delete jobs[i];
+    }
+}
+
+/* CookingPool */
+
+CookingPool::CookingPool(const PxCookingParams& params)
+    : _params(params), _numCreated(0)
+{
+}
+
+CookingPool::~CookingPool()
+{
+    for (unsigned int i = 0; i < _freeCookings.size(); ++i) _freeCookings[i]->release();
+    if (_freeCookings.size() < _numCreated)
+        OSG_WARN << "[CookingPool] Some cooking objects are not released before deleting the pool" << std::endl;
+}
+
+PxCooking* CookingPool::acquire()
+{
+    {
+        OpenThreads::ScopedLock<OpenThreads::Mutex> lock(_mutex);
+        if (!_freeCookings.empty())
+        {
+            PxCooking* cooking = _freeCookings.back();
+            _freeCookings.pop_back(); return cooking;
+        }
+    }
+
+    PxCooking* cooking = PxCreateCooking(PX_PHYSICS_VERSION, SDK_OBJ->getFoundation(), _params);
+    if (!cooking) { OSG_WARN << "[CookingPool] Failed to create cooking object" << std::endl; return NULL; }
+
+    OpenThreads::ScopedLock<OpenThreads::Mutex> lock(_mutex);
+    _numCreated++; return cooking;
+}
+
+void CookingPool::release(PxCooking* cooking)
+{
+    if (!cooking) return;
+    OpenThreads::ScopedLock<OpenThreads::Mutex> lock(_mutex);
+    _freeCookings.push_back(cooking);
 }
 
 /* MemoryOutputStream */
 
+MemoryOutputStream::MemoryOutputStream(PxU32 sizeHint)
+    : _data(NULL), _size(0), _capacity(0)
+{
+    if (sizeHint > 0) reserve(sizeHint);
+}
+
 MemoryOutputStream::~MemoryOutputStream()
 {
     if (_data) delete[] _data;
 }
 
+void MemoryOutputStream::reserve(PxU32 capacity)
+{
+    if (capacity <= _capacity) return;
+    PxU8* newData = new PxU8[capacity];
+    if (_data)
+    {
+        memcpy(newData, _data, _size);
+        delete[] _data;
+    }
+    _data = newData;
+    _capacity = capacity;
+}
+
 PxU32 MemoryOutputStream::write(const void* src, PxU32 count)
 {
     PxU32 expectedSize = _size + count;
     if (expectedSize > _capacity)
     {
-        _capacity = expectedSize + 4096;
-        PxU8* newData = new PxU8[_capacity];
-        if (newData)
-        {
-            memcpy(newData, _data, _size);
-            delete[] _data;
-        }
-        _data = newData;
+        // Grow geometrically so that many small writes of cooking cost amortized constant time
+        PxU32 capacity = PxMax<PxU32>(_capacity + _capacity / 2, 4096);
+        reserve(PxMax(capacity, expectedSize));
     }
     memcpy(_data + _size, src, count);
     _size += count;
     return count;
 }
 
+/* CookingStreamPool */
+
+/** Output streams reused by all cooking calls, so that buffers are not allocated again for every mesh.
+    Each concurrent cooking call takes its own stream, and very large ones are not kept
+*/
+class CookingStreamPool
+{
+public:
+    ~CookingStreamPool()
+    {
+        for (unsigned int i = 0; i < _freeStreams.size(); ++i) delete _freeStreams[i];
+    }
+
+    MemoryOutputStream* acquire(PxU32 sizeHint)
+    {
+        MemoryOutputStream* stream = NULL;
+        {
+            OpenThreads::ScopedLock<OpenThreads::Mutex> lock(_mutex);
+            if (!_freeStreams.empty()) { stream = _freeStreams.back(); _freeStreams.pop_back(); }
+        }
+        if (!stream) return new MemoryOutputStream(sizeHint);
+        stream->reset();
+        stream->reserve(sizeHint);
+        return stream;
+    }
+
+    void release(MemoryOutputStream* stream)
+    {
+        if (stream->getCapacity() > 64 * 1024 * 1024) { delete stream; return; }
+        OpenThreads::ScopedLock<OpenThreads::Mutex> lock(_mutex);
+        _freeStreams.push_back(stream);
+    }
+
+protected:
+    std::vector<MemoryOutputStream*> _freeStreams;
+    OpenThreads::Mutex _mutex;
+};
+static CookingStreamPool s_cookingStreams;
+
+/** The stream taken from the pool in current scope */
+struct ScopedCookingStream
+{
+    ScopedCookingStream(PxU32 sizeHint) : stream(*s_cookingStreams.acquire(sizeHint)) {}
+    ~ScopedCookingStream() { s_cookingStreams.release(&stream); }
+    MemoryOutputStream& stream;
+};
+
 /* MemoryInputData */
 
 MemoryInputData::MemoryInputData(PxU8* data, PxU32 length)
@@ -147,21 +527,239 @@ void MemoryInputData::seek(PxU32 pos)
     _pos = PxMin<PxU32>(_size, pos);
 }
 
+/* MappedFileInputData */
+
+MappedFileInputData::MappedFileInputData()
+    : _base(NULL), _data(NULL), _fileSize(0), _length(0), _pos(0), _fileHandle(NULL), _mappingHandle(NULL),
+    _copyOnWrite(false)
+{
+}
+
+MappedFileInputData::MappedFileInputData(const std::string& fileName)
+    : _base(NULL), _data(NULL), _fileSize(0), _length(0), _pos(0), _fileHandle(NULL), _mappingHandle(NULL),
+    _copyOnWrite(false)
+{
+    open(fileName);
+}
+
+MappedFileInputData::~MappedFileInputData()
+{
+    close();
+}
+
+bool MappedFileInputData::open(const std::string& fileName, bool copyOnWrite)
+{
+    close();
+    _copyOnWrite = copyOnWrite;
+#ifdef WIN32
+    HANDLE file = CreateFileA(fileName.c_str(), GENERIC_READ, FILE_SHARE_READ, NULL,
+                              OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL);
+    if (file == INVALID_HANDLE_VALUE) return false;
+    _fileHandle = file;
+
+    LARGE_INTEGER size;
+    if (GetFileSizeEx(file, &size) && size.QuadPart > 0)
+    {
+        _fileSize = (PxU32)size.QuadPart;
+        _mappingHandle = CreateFileMappingA(file, NULL, copyOnWrite ? PAGE_WRITECOPY : PAGE_READONLY, 0, 0, NULL);
+        if (_mappingHandle) _base = (const PxU8*)MapViewOfFile(
+            _mappingHandle, copyOnWrite ? FILE_MAP_COPY : FILE_MAP_READ, 0, 0, 0);
+    }
+#else
+    int fd = ::open(fileName.c_str(), O_RDONLY);
+    if (fd < 0) return false;
+
+    struct stat st;
+    if (fstat(fd, &st) == 0 && st.st_size > 0)
+    {
+        _fileSize = (PxU32)st.st_size;
+        void* ptr = mmap(NULL, _fileSize, copyOnWrite ? (PROT_READ | PROT_WRITE) : PROT_READ, MAP_PRIVATE, fd, 0);
+        if (ptr != MAP_FAILED) _base = (const PxU8*)ptr;
+    }
+    ::close(fd);
+#endif
+
+    if (!_base)
+    {
+        // Mapping may be unavailable on some file systems, so read into memory with the same alignment as pages
+        std::ifstream in(fileName.c_str(), std::ios::in | std::ios::binary | std::ios::ate);
+        std::streamoff size = in ? (std::streamoff)in.tellg() : 0;
+        if (size <= 0) { close(); return false; }
+
+        _buffer.resize((size_t)size + 128);
+        size_t offset = (128 - ((size_t)&_buffer[0] & 127)) & 127;
+        in.seekg(0); in.read(&_buffer[offset], size);
+        if (!in) { close(); return false; }
+        _fileSize = (PxU32)size;
+        _base = (const PxU8*)&_buffer[offset];
+    }
+    return setRange(0, _fileSize);
+}
+
+void MappedFileInputData::close()
+{
+#ifdef WIN32
+    if (_base && _buffer.empty()) UnmapViewOfFile(_base);
+    if (_mappingHandle) CloseHandle((HANDLE)_mappingHandle);
+    if (_fileHandle) CloseHandle((HANDLE)_fileHandle);
+#else
+    if (_base && _buffer.empty()) munmap((void*)_base, _fileSize);
+#endif
+    std::vector<char>().swap(_buffer);
+    _base = NULL; _data = NULL; _fileSize = 0; _length = 0; _pos = 0;
+    _fileHandle = NULL; _mappingHandle = NULL;
+}
+
+bool MappedFileInputData::setRange(PxU32 offset, PxU32 length)
+{
+    if (!_base || offset > _fileSize || length > _fileSize - offset) return false;
+    _data = _base + offset; _length = length; _pos = 0;
+    return true;
+}
+
+PxU32 MappedFileInputData::read(void* dest, PxU32 count)
+{
+    PxU32 length = PxMin<PxU32>(count, _length - _pos);
+    memcpy(dest, _data + _pos, length);
+    _pos += length;
+    return length;
+}
+
+void MappedFileInputData::seek(PxU32 pos)
+{
+    _pos = PxMin<PxU32>(_length, pos);
+}
+
 namespace osgPhysics
 {
 
+    static PxConvexMesh* cookConvexMesh(const PxConvexMeshDesc& convexDesc)
+    {
+        CookingCache* cache = CookingCache::instance();
+        PxU64 key = 0;
+        if (cache->isEnabled())
+        {
+            CookingHash hash;
+            hash.addStrided(convexDesc.points, sizeof(PxVec3));
+            hash.addStrided(convexDesc.indices, 3 * sizeof(PxU32));
+            hash.addValue((PxU32)convexDesc.flags);
+            hash.addValue(convexDesc.vertexLimit);
+            hash.addCookingParams(SDK_COOK->getParams());
+            key = hash.get();
+
+            PxInputData* cached = cache->read(CookingCache::CONVEX_MESH, key);
+            if (cached)
+            {
+                PxConvexMesh* mesh = SDK_OBJ->createConvexMesh(*cached);
+                delete cached; if (mesh) return mesh;
+            }
+        }
+
+        ScopedCookingStream scopedStream(convexDesc.points.count * sizeof(PxVec3));
+        MemoryOutputStream& writeBuffer = scopedStream.stream;
+        if (!SDK_COOK->cookConvexMesh(convexDesc, writeBuffer)) return NULL;
+        if (cache->isEnabled())
+            cache->write(CookingCache::CONVEX_MESH, key, writeBuffer.getData(), writeBuffer.getSize());
+
+        MemoryInputData readBuffer(writeBuffer.getData(), writeBuffer.getSize());
+        return SDK_OBJ->createConvexMesh(readBuffer);
+    }
+
     PxMat44 toPxMatrix(const osg::Matrix& matrix)
     {
-        PxReal d[16];
-        for (int i = 0; i < 16; ++i) d[i] = *(matrix.ptr() + i);
-        return PxMat44(d);
+        // Row i of the OSG matrix is column i of the PhysX one, so memory layouts are the same
+        PxMat44 result;
+        PxReal* d = &result.column0.x;
+        const osg::Matrix::value_type* m = matrix.ptr();
+        for (int i = 0; i < 16; ++i) d[i] = (PxReal)m[i];
+        return result;
     }
 
     osg::Matrix toMatrix(const PxMat44& pmatrix)
     {
-        double m[16];
-        for (int i = 0; i < 16; ++i) m[i] = *(pmatrix.front() + i);
-        return osg::Matrix(&m[0]);
+        return osg::Matrix(pmatrix.front());
+    }
+
+    static inline void convertTransform(const PxTransform& t, osg::Matrix::value_type* m)
+    {
+        const PxReal x2 = t.q.x + t.q.x, y2 = t.q.y + t.q.y, z2 = t.q.z + t.q.z;
+        const PxReal xx = x2 * t.q.x, yy = y2 * t.q.y, zz = z2 * t.q.z;
+        const PxReal xy = x2 * t.q.y, xz = x2 * t.q.z, yz = y2 * t.q.z;
+        const PxReal xw = x2 * t.q.w, yw = y2 * t.q.w, zw = z2 * t.q.w;
+        m[0] = 1.0f - yy - zz; m[1] = xy + zw; m[2] = xz - yw; m[3] = 0.0;
+        m[4] = xy - zw; m[5] = 1.0f - xx - zz; m[6] = yz + xw; m[7] = 0.0;
+        m[8] = xz + yw; m[9] = yz - xw; m[10] = 1.0f - xx - yy; m[11] = 0.0;
+        m[12] = t.p.x; m[13] = t.p.y; m[14] = t.p.z; m[15] = 1.0;
+    }
+
+#ifdef OSGPHYSICS_USE_SSE2
+    static inline void storeRow(double* d, __m128 v)
+    {
+#   ifdef OSGPHYSICS_USE_AVX
+        _mm256_storeu_pd(d, _mm256_cvtps_pd(v));
+#   else
+        _mm_storeu_pd(d, _mm_cvtps_pd(v));
+        _mm_storeu_pd(d + 2, _mm_cvtps_pd(_mm_movehl_ps(v, v)));
+#   endif
+    }
+
+    static void convertTransforms4(const PxTransform* t, osg::Matrix* matrices)
+    {
+        // Load 4 quaternions (the first 16 bytes of each transform) and transpose to SoA form
+        __m128 qx = _mm_loadu_ps(&t[0].q.x), qy = _mm_loadu_ps(&t[1].q.x);
+        __m128 qz = _mm_loadu_ps(&t[2].q.x), qw = _mm_loadu_ps(&t[3].q.x);
+        _MM_TRANSPOSE4_PS(qx, qy, qz, qw);
+
+        const __m128 one = _mm_set1_ps(1.0f), zero = _mm_setzero_ps();
+        const __m128 x2 = _mm_add_ps(qx, qx), y2 = _mm_add_ps(qy, qy), z2 = _mm_add_ps(qz, qz);
+        const __m128 xx = _mm_mul_ps(x2, qx), yy = _mm_mul_ps(y2, qy), zz = _mm_mul_ps(z2, qz);
+        const __m128 xy = _mm_mul_ps(x2, qy), xz = _mm_mul_ps(x2, qz), yz = _mm_mul_ps(y2, qz);
+        const __m128 xw = _mm_mul_ps(x2, qw), yw = _mm_mul_ps(y2, qw), zw = _mm_mul_ps(z2, qw);
+
+        // Compute rotation rows of all 4 matrices, then transpose back to one row per matrix
+        __m128 a0 = _mm_sub_ps(_mm_sub_ps(one, yy), zz), a1 = _mm_add_ps(xy, zw),
+               a2 = _mm_sub_ps(xz, yw), a3 = zero;
+        __m128 b0 = _mm_sub_ps(xy, zw), b1 = _mm_sub_ps(_mm_sub_ps(one, xx), zz),
+               b2 = _mm_add_ps(yz, xw), b3 = zero;
+        __m128 c0 = _mm_add_ps(xz, yw), c1 = _mm_sub_ps(yz, xw),
+               c2 = _mm_sub_ps(_mm_sub_ps(one, xx), yy), c3 = zero;
+        _MM_TRANSPOSE4_PS(a0, a1, a2, a3);
+        _MM_TRANSPOSE4_PS(b0, b1, b2, b3);
+        _MM_TRANSPOSE4_PS(c0, c1, c2, c3);
+
+        const __m128 rows0[4] = { a0, a1, a2, a3 }, rows1[4] = { b0, b1, b2, b3 }, rows2[4] = { c0, c1, c2, c3 };
+        for (int i = 0; i < 4; ++i)
+        {
+            double* m = matrices[i].ptr();
+            storeRow(m, rows0[i]); storeRow(m + 4, rows1[i]); storeRow(m + 8, rows2[i]);
+            m[12] = t[i].p.x; m[13] = t[i].p.y; m[14] = t[i].p.z; m[15] = 1.0;
+        }
+    }
+#endif
+
+    osg::Matrix toMatrix(const PxTransform& pose)
+    {
+        osg::Matrix matrix;
+        convertTransform(pose, matrix.ptr());
+        return matrix;
+    }
+
+    void toMatrices(const PxTransform* poses, osg::Matrix* matrices, unsigned int count)
+    {
+        unsigned int i = 0;
+#ifdef OSGPHYSICS_USE_SSE2
+        for (; i + 4 <= count; i += 4) convertTransforms4(poses + i, matrices + i);
+#endif
+        for (; i < count; ++i) convertTransform(poses[i], matrices[i].ptr());
+    }
+
+    osg::Matrix toMatrix(const PxTransform& t0, const PxTransform& t1, double alpha)
+    {
+        osg::Quat q0(t0.q.x, t0.q.y, t0.q.z, t0.q.w), q1(t1.q.x, t1.q.y, t1.q.z, t1.q.w), q;
+        q.slerp(alpha, q0, q1);
+
+        osg::Vec3d p0(t0.p.x, t0.p.y, t0.p.z), p1(t1.p.x, t1.p.y, t1.p.z);
+        return osg::Matrix::rotate(q) * osg::Matrix::translate(p0 + (p1 - p0) * alpha);
     }
 
     PxConvexMesh* createConvexMesh(const std::vector<PxVec3>& verts, PxConvexFlags flags)
@@ -172,33 +770,15 @@ namespace osgPhysics
         convexDesc.points.data = &(verts[0]);
         convexDesc.flags = flags;
 
-        MemoryOutputStream writeBuffer;
-        if (!SDK_COOK->cookConvexMesh(convexDesc, writeBuffer)) return NULL;
-
-        MemoryInputData readBuffer(writeBuffer.getData(), writeBuffer.getSize());
-        return SDK_OBJ->createConvexMesh(readBuffer);
+        return cookConvexMesh(convexDesc);
     }
 
-    PxConvexMesh* createConvexMesh(osg::Node& node, PxConvexFlags flags)
+    PxConvexMesh* createConvexMesh(osg::Node& node, PxConvexFlags flags, PxCpuDispatcher* dispatcher,
+                                   unsigned int verticesPerChunk)
     {
-        GeometryDataCollector collector;
-        node.accept(collector);
-
         std::vector<PxVec3> verts;
-        for (unsigned int i = 0; i < collector.vertices.size(); ++i)
-        {
-            const osg::Vec3& v = collector.vertices[i];
-            verts.push_back(PxVec3(v[0], v[1], v[2]));
-        }
-
         std::vector<PxU32> indices;
-        for (unsigned int i = 0; i < collector.faces.size(); ++i)
-        {
-            const GeometryDataCollector::GeometryFace& f = collector.faces[i];
-            indices.push_back(f.indices[0]);
-            indices.push_back(f.indices[1]);
-            indices.push_back(f.indices[2]);
-        }
+        collectGeometryData(node, dispatcher, verticesPerChunk, false, verts, indices);
         if (!verts.size() || !indices.size()) return NULL;
 
         PxConvexMeshDesc convexDesc;
@@ -210,11 +790,7 @@ namespace osgPhysics
         convexDesc.indices.data = &(indices[0]);
         convexDesc.flags = flags;
 
-        MemoryOutputStream writeBuffer;
-        if (!SDK_COOK->cookConvexMesh(convexDesc, writeBuffer)) return NULL;
-
-        MemoryInputData readBuffer(writeBuffer.getData(), writeBuffer.getSize());
-        return SDK_OBJ->createConvexMesh(readBuffer);
+        return cookConvexMesh(convexDesc);
     }
 
     PxHeightField* createHeightField(unsigned int numRows, unsigned int numColumns, const float* heightData,
@@ -247,8 +823,43 @@ namespace osgPhysics
             }
         }
 
-        PxHeightField* heightField = SDK_COOK->createHeightField(
-            heightFieldDesc, SDK_OBJ->getPhysicsInsertionCallback());
+        PxHeightField* heightField = NULL;
+        CookingCache* cache = CookingCache::instance();
+        if (cache->isEnabled())
+        {
+            CookingHash hash;
+            hash.addStrided(heightFieldDesc.samples, sizeof(PxHeightFieldSample));
+            hash.addValue(numRows); hash.addValue(numColumns); hash.addValue(thickness);
+            hash.addValue((PxU32)heightFieldDesc.format);
+            hash.addValue((PxU32)heightFieldDesc.flags);
+            hash.addValue(heightFieldDesc.convexEdgeThreshold);
+            PxU64 key = hash.get();
+
+            PxInputData* cached = cache->read(CookingCache::HEIGHT_FIELD, key);
+            if (cached)
+            {
+                heightField = SDK_OBJ->createHeightField(*cached);
+                delete cached;
+            }
+
+            if (!heightField)
+            {
+                // Cook to a stream instead of inserting directly, so that the result can be cached
+                ScopedCookingStream scopedStream(numRows * numColumns * sizeof(PxHeightFieldSample) + 1024);
+                MemoryOutputStream& writeBuffer = scopedStream.stream;
+                if (SDK_COOK->cookHeightField(heightFieldDesc, writeBuffer))
+                {
+                    cache->write(CookingCache::HEIGHT_FIELD, key, writeBuffer.getData(), writeBuffer.getSize());
+                    MemoryInputData readBuffer(writeBuffer.getData(), writeBuffer.getSize());
+                    heightField = SDK_OBJ->createHeightField(readBuffer);
+                }
+            }
+        }
+        else
+        {
+            heightField = SDK_COOK->createHeightField(
+                heightFieldDesc, SDK_OBJ->getPhysicsInsertionCallback());
+        }
         free(samplesData);
         return heightField;
     }
@@ -283,8 +894,10 @@ namespace osgPhysics
         return createConvexMesh(verts);
     }
 
-    PxTriangleMesh* createTriangleMesh(const std::vector<PxVec3>& verts, const std::vector<PxU32>& indices)
+    PxTriangleMesh* createTriangleMesh(const std::vector<PxVec3>& verts, const std::vector<PxU32>& indices,
+                                       PxCooking* cooking)
     {
+        if (!cooking) cooking = SDK_COOK;
         PxTriangleMeshDesc meshDesc;
         meshDesc.points.count = verts.size();
         meshDesc.points.stride = sizeof(PxVec3);
@@ -293,37 +906,66 @@ namespace osgPhysics
         meshDesc.triangles.stride = 3 * sizeof(PxU32);
         meshDesc.triangles.data = &(indices[0]);
 
-        MemoryOutputStream writeBuffer;
-        if (!SDK_COOK->cookTriangleMesh(meshDesc, writeBuffer)) return NULL;
+        CookingCache* cache = CookingCache::instance();
+        PxU64 key = 0;
+        if (cache->isEnabled())
+        {
+            CookingHash hash;
+            hash.addStrided(meshDesc.points, sizeof(PxVec3));
+            hash.addStrided(meshDesc.triangles, 3 * sizeof(PxU32));
+            hash.addValue((PxU32)meshDesc.flags);
+            hash.addCookingParams(cooking->getParams());
+            key = hash.get();
+
+            PxInputData* cached = cache->read(CookingCache::TRIANGLE_MESH, key);
+            if (cached)
+            {
+                PxTriangleMesh* mesh = SDK_OBJ->createTriangleMesh(*cached);
+                delete cached; if (mesh) return mesh;
+            }
+        }
+
+        // Cooked meshes are usually a bit larger than the source data with extra midphase structures
+        ScopedCookingStream scopedStream(verts.size() * sizeof(PxVec3) * 2 + indices.size() * sizeof(PxU32) * 2);
+        MemoryOutputStream& writeBuffer = scopedStream.stream;
+        if (!cooking->cookTriangleMesh(meshDesc, writeBuffer)) return NULL;
+        if (cache->isEnabled())
+            cache->write(CookingCache::TRIANGLE_MESH, key, writeBuffer.getData(), writeBuffer.getSize());
 
         MemoryInputData readBuffer(writeBuffer.getData(), writeBuffer.getSize());
         return SDK_OBJ->createTriangleMesh(readBuffer);
     }
 
-    PxTriangleMesh* createTriangleMesh(osg::Node& node)
+    PxTriangleMesh* createTriangleMesh(osg::Node& node, PxCpuDispatcher* dispatcher, unsigned int verticesPerChunk)
     {
-        GeometryDataCollector collector;
-        node.accept(collector);
-
         std::vector<PxVec3> verts;
-        for (unsigned int i = 0; i < collector.vertices.size(); ++i)
-        {
-            const osg::Vec3& v = collector.vertices[i];
-            verts.push_back(PxVec3(v[0], v[1], v[2]));
-        }
-
         std::vector<PxU32> indices;
-        for (unsigned int i = 0; i < collector.faces.size(); ++i)
-        {
-            const GeometryDataCollector::GeometryFace& f = collector.faces[i];
-            indices.push_back(f.indices[0]);
-            indices.push_back(f.indices[1]);
-            indices.push_back(f.indices[2]);
-        }
+        collectGeometryData(node, dispatcher, verticesPerChunk, true, verts, indices);
         if (!verts.size() || !indices.size()) return NULL;
         return createTriangleMesh(verts, indices);
     }
 
+    unsigned int createTriangleMeshes(osg::Node& node, std::vector<PxTriangleMesh*>& meshes,
+                                      PxCpuDispatcher* dispatcher, unsigned int verticesPerChunk, CookingPool* pool)
+    {
+        // Create shared objects on the calling thread, as their lazy creation is not thread-safe
+        osg::ref_ptr<CookingPool> localPool = pool;
+        if (!localPool) localPool = new CookingPool(SDK_COOK->getParams());
+        CookingCache::instance();
+
+        std::vector<GeodeChunk> chunks;
+        std::vector<CollectChunkJob*> jobs;
+        runCollectChunkJobs(node, dispatcher, verticesPerChunk, localPool.get(), chunks, jobs);
+
+        unsigned int numMeshes = 0;
+        for (unsigned int i = 0; i < jobs.size(); ++i)
+        {
+            if (jobs[i]->getMesh()) { meshes.push_back(jobs[i]->getMesh()); numMeshes++; }
+            delete jobs[i];
+        }
+        return numMeshes;
+    }
+
 #if !(PX_PHYSICS_VERSION_MAJOR > 3)
     PxClothFabric* createClothFabric(const std::vector<PxVec3>& verts, const std::vector<PxU32>& indices,
         const osg::Vec3& gravity)
@@ -341,12 +983,13 @@ namespace osgPhysics
     }
 #endif
     PxScene* createScene(const osg::Vec3& gravity, const PxSimulationFilterShader& filter,
-        physx::PxSceneFlags flags, unsigned int numThreads, bool useGPU)
+        physx::PxSceneFlags flags, unsigned int numThreads, bool useGPU, PxCpuDispatcher* dispatcher)
     {
         PxSceneDesc sceneDesc(SDK_OBJ->getTolerancesScale());
         sceneDesc.gravity = PxVec3(gravity[0], gravity[1], gravity[2]);
         sceneDesc.filterShader = filter;
         sceneDesc.flags |= flags;
+        sceneDesc.cpuDispatcher = dispatcher;
 
         if (useGPU)
         {
@@ -473,6 +1116,26 @@ namespace osgPhysics
         return actor;
     }
 
+    PxRigidActor* createTriangleMeshActor(osg::Node& node, PxCpuDispatcher* dispatcher, PxMaterial* mtl,
+                                          unsigned int verticesPerChunk, CookingPool* pool)
+    {
+        std::vector<PxTriangleMesh*> meshes;
+        if (!createTriangleMeshes(node, meshes, dispatcher, verticesPerChunk, pool)) return NULL;
+
+        PxRigidStatic* actor = SDK_OBJ->createRigidStatic(PxTransform(PxIdentity));
+        for (unsigned int i = 0; i < meshes.size(); ++i)
+        {
+            PxTriangleMeshGeometry geometry(meshes[i]);
+#if PX_PHYSICS_VERSION_MAJOR > 3
+            PxRigidActorExt::createExclusiveShape(*actor, geometry, mtl ? *mtl : *DEF_MTL);
+#else
+            actor->createShape(geometry, mtl ? *mtl : *DEF_MTL);
+#endif
+            meshes[i]->release();  // held by the shape now
+        }
+        return actor;
+    }
+
     PxRigidActor* createPlaneActor(const osg::Plane& plane, PxMaterial* mtl)
     {
         osg::Quat q;
@@ -499,146 +1162,34 @@ namespace osgPhysics
         std::vector<PxShape*> shapes(actor->getNbShapes());
 
         osg::ref_ptr<osg::MatrixTransform> transform = new osg::MatrixTransform;
-        transform->setMatrix(toMatrix(PxMat44(actor->getGlobalPose())));
-
-        osg::ref_ptr<osg::Geode> geode = new osg::Geode;
-        transform->addChild(geode.get());
+        transform->setMatrix(toMatrix(actor->getGlobalPose()));
+        if (shapes.empty()) return transform.release();
 
+        GeometryDrawableCache* cache = GeometryDrawableCache::instance();
         PxU32 num = actor->getShapes(&(shapes[0]), actor->getNbShapes());
         for (PxU32 i = 0; i < num; ++i)
         {
             PxShape* shape = shapes[i];
-            osg::Matrix localMatrix = toMatrix(PxMat44(actor->getGlobalPose()));
-            osg::Vec3 localPos = toVec3(shape->getLocalPose().p);
-            osg::Quat localQuat(shape->getLocalPose().q.x, shape->getLocalPose().q.y,
-                shape->getLocalPose().q.z, shape->getLocalPose().q.w);
+            PxGeometryHolder geometry = shape->getGeometry();
+            osg::ref_ptr<osg::Geode> geode = cache->getOrCreate(geometry.any());
+            if (!geode) continue;
 
-            switch (shape->getGeometryType())
+            // Shared geodes are in their own space, so place them with local poses of shapes
+            osg::Matrix localMatrix = toMatrix(shape->getLocalPose());
+            if (geometry.getType() == PxGeometryType::eHEIGHTFIELD)
             {
-            case PxGeometryType::eSPHERE:
-                {
-                    PxSphereGeometry sphere;
-                    shape->getSphereGeometry(sphere);
-
-                    osg::Sphere* sphereShape = new osg::Sphere(localPos, sphere.radius);
-                    geode->addDrawable(new osg::ShapeDrawable(sphereShape));
-                }
-                break;
-            case PxGeometryType::ePLANE:
-                // TODO
-                break;
-            case PxGeometryType::eCAPSULE:
-                {
-                    PxCapsuleGeometry capsule;
-                    shape->getCapsuleGeometry(capsule);
-
-                    osg::Capsule* capsuleShape = new osg::Capsule(
-                        localPos, capsule.radius, capsule.halfHeight * 2.0f);
-                    capsuleShape->setRotation(localQuat);
-                    geode->addDrawable(new osg::ShapeDrawable(capsuleShape));
-                }
-                break;
-            case PxGeometryType::eBOX:
-                {
-                    PxBoxGeometry box;
-                    shape->getBoxGeometry(box);
+                // Note the coord difference between PhysX and OSG height-fields
+                localMatrix = osg::Matrix::rotate(-osg::PI_2, osg::Y_AXIS)
+                            * osg::Matrix::rotate(-osg::PI_2, osg::Z_AXIS) * localMatrix;
+            }
 
-                    osg::Box* boxShape = new osg::Box(localPos,
-                        box.halfExtents[0] * 2.0f, box.halfExtents[1] * 2.0f, box.halfExtents[2] * 2.0f);
-                    boxShape->setRotation(localQuat);
-                    geode->addDrawable(new osg::ShapeDrawable(boxShape));
-                }
-                break;
-            case PxGeometryType::eCONVEXMESH:
-                {
-                    PxConvexMeshGeometry convexMeshGeom;
-                    shape->getConvexMeshGeometry(convexMeshGeom);
-                    // TODO: consider convexMeshGeom.scale
-
-                    PxConvexMesh* convexMesh = convexMeshGeom.convexMesh;
-                    if (convexMesh)
-                    {
-                        /*for ( unsigned int i=0; i<convexMesh->getNbPolygons(); ++i )
-                        {
-
-                        }*/
-                        // TODO
-                    }
-                }
-                break;
-            case PxGeometryType::eTRIANGLEMESH:
-                {
-                    PxTriangleMeshGeometry triangleMeshGeom;
-                    shape->getTriangleMeshGeometry(triangleMeshGeom);
-                    // TODO: consider triangleMeshGeom.scale
-
-                    PxTriangleMesh* triangleMesh = triangleMeshGeom.triangleMesh;
-                    if (triangleMesh)
-                    {
-                        osg::ref_ptr<osg::Vec3Array> va = new osg::Vec3Array(triangleMesh->getNbVertices());
-                        for (unsigned int i = 0; i < va->size(); ++i)
-                            (*va)[i] = toVec3(*(triangleMesh->getVertices() + i)) * localMatrix;
-
-                        osg::ref_ptr<osg::DrawElements> de;
-                        if (triangleMesh->getTriangleMeshFlags()&PxTriangleMeshFlag::e16_BIT_INDICES)
-                        {
-                            osg::DrawElementsUShort* de16 = new osg::DrawElementsUShort(GL_TRIANGLES);
-                            de = de16;
-
-                            const PxU16* indices = (const PxU16*)triangleMesh->getTriangles();
-                            for (unsigned int i = 0; i < triangleMesh->getNbTriangles(); ++i)
-                            {
-                                de16->push_back(indices[3 * i + 0]);
-                                de16->push_back(indices[3 * i + 1]);
-                                de16->push_back(indices[3 * i + 2]);
-                            }
-                        }
-                        else
-                        {
-                            osg::DrawElementsUInt* de32 = new osg::DrawElementsUInt(GL_TRIANGLES);
-                            de = de32;
-
-                            const PxU32* indices = (const PxU32*)triangleMesh->getTriangles();
-                            for (unsigned int i = 0; i < triangleMesh->getNbTriangles(); ++i)
-                            {
-                                de32->push_back(indices[3 * i + 0]);
-                                de32->push_back(indices[3 * i + 1]);
-                                de32->push_back(indices[3 * i + 2]);
-                            }
-                        }
-                        geode->addDrawable(createGeometry(va.get(), NULL, NULL, de.get()));
-                    }
-                }
-                break;
-            case PxGeometryType::eHEIGHTFIELD:
-                {
-                    PxHeightFieldGeometry hfGeom;
-                    shape->getHeightFieldGeometry(hfGeom);
-
-                    PxHeightField* hf = hfGeom.heightField;
-                    if (hf)
-                    {
-                        osg::HeightField* grid = new osg::HeightField;
-                        grid->allocate(hf->getNbColumns(), hf->getNbRows());
-                        grid->setOrigin(osg::Vec3(0.0f, 0.0f, 0.0f));
-                        grid->setXInterval(hfGeom.columnScale);
-                        grid->setYInterval(hfGeom.rowScale);
-
-                        float zScale = hfGeom.heightScale;
-                        for (unsigned int r = 0; r < hf->getNbRows(); ++r)
-                            for (unsigned int c = 0; c < hf->getNbColumns(); ++c)
-                            {
-                                const PxHeightFieldSample& s = hf->getSample(r, c);
-                                grid->setHeight(c, r, (float)s.height * zScale);
-                            }
-                        
-                        geode->addDrawable(new osg::ShapeDrawable(grid));
-                        transform->setMatrix(osg::Matrix::rotate(-osg::PI_2, osg::Y_AXIS)
-                                           * osg::Matrix::rotate(-osg::PI_2, osg::Z_AXIS)
-                                           * transform->getMatrix());
-                    }
-                }
-                break;
+            if (localMatrix.isIdentity())
+                transform->addChild(geode.get());
+            else
+            {
+                osg::ref_ptr<osg::MatrixTransform> local = new osg::MatrixTransform(localMatrix);
+                local->addChild(geode.get());
+                transform->addChild(local.get());
             }
         }
         return transform.release();
@@ -685,4 +1236,294 @@ namespace osgPhysics
         return geom.release();
     }
 
+    GeometryKey::GeometryKey(const PxGeometry& geom)
+        : type(geom.getType()), data(NULL)
+    {
+        for (unsigned int i = 0; i < 7; ++i) params[i] = 0.0f;
+        switch (type)
+        {
+        case PxGeometryType::eSPHERE:
+            params[0] = static_cast<const PxSphereGeometry&>(geom).radius; break;
+        case PxGeometryType::eCAPSULE:
+            {
+                const PxCapsuleGeometry& capsule = static_cast<const PxCapsuleGeometry&>(geom);
+                params[0] = capsule.radius; params[1] = capsule.halfHeight;
+            }
+            break;
+        case PxGeometryType::eBOX:
+            {
+                const PxBoxGeometry& box = static_cast<const PxBoxGeometry&>(geom);
+                params[0] = box.halfExtents.x; params[1] = box.halfExtents.y; params[2] = box.halfExtents.z;
+            }
+            break;
+        case PxGeometryType::eCONVEXMESH:
+            {
+                const PxConvexMeshGeometry& convex = static_cast<const PxConvexMeshGeometry&>(geom);
+                data = convex.convexMesh; setMeshScale(convex.scale);
+            }
+            break;
+        case PxGeometryType::eTRIANGLEMESH:
+            {
+                const PxTriangleMeshGeometry& mesh = static_cast<const PxTriangleMeshGeometry&>(geom);
+                data = mesh.triangleMesh; setMeshScale(mesh.scale);
+            }
+            break;
+        case PxGeometryType::eHEIGHTFIELD:
+            {
+                const PxHeightFieldGeometry& hf = static_cast<const PxHeightFieldGeometry&>(geom);
+                data = hf.heightField;
+                params[0] = hf.rowScale; params[1] = hf.columnScale; params[2] = hf.heightScale;
+            }
+            break;
+        default: break;
+        }
+    }
+
+    void GeometryKey::setMeshScale(const PxMeshScale& scale)
+    {
+        params[0] = scale.scale.x; params[1] = scale.scale.y; params[2] = scale.scale.z;
+        params[3] = scale.rotation.x; params[4] = scale.rotation.y;
+        params[5] = scale.rotation.z; params[6] = scale.rotation.w;
+    }
+
+    bool GeometryKey::operator<(const GeometryKey& rhs) const
+    {
+        if (type != rhs.type) return type < rhs.type;
+        if (data != rhs.data) return data < rhs.data;
+        for (unsigned int i = 0; i < 7; ++i)
+        { if (params[i] != rhs.params[i]) return params[i] < rhs.params[i]; }
+        return false;
+    }
+
+    static osg::Geometry* createConvexMeshGeometry(const PxConvexMesh& mesh, const PxMeshScale& scale)
+    {
+        PxMat33 scaleMatrix = scale.toMat33();
+        PxMat33 normalMatrix = scaleMatrix.getInverse().getTranspose();
+        const PxVec3* vertices = mesh.getVertices();
+        const PxU8* indexBuffer = mesh.getIndexBuffer();
+
+        // Triangulate each polygon as a fan with the flat normal of its plane
+        osg::ref_ptr<osg::Vec3Array> va = new osg::Vec3Array;
+        osg::ref_ptr<osg::Vec3Array> na = new osg::Vec3Array;
+        for (PxU32 i = 0; i < mesh.getNbPolygons(); ++i)
+        {
+            PxHullPolygon polygon;
+            if (!mesh.getPolygonData(i, polygon) || polygon.mNbVerts < 3) continue;
+
+            const PxU8* indices = indexBuffer + polygon.mIndexBase;
+            PxVec3 normal = normalMatrix * PxVec3(polygon.mPlane[0], polygon.mPlane[1], polygon.mPlane[2]);
+            normal.normalize();
+
+            PxVec3 v0 = scaleMatrix * vertices[indices[0]];
+            for (PxU32 j = 1; j + 1 < polygon.mNbVerts; ++j)
+            {
+                PxVec3 v1 = scaleMatrix * vertices[indices[j]], v2 = scaleMatrix * vertices[indices[j + 1]];
+                if ((v1 - v0).cross(v2 - v0).dot(normal) < 0.0f) std::swap(v1, v2);  // e.g., mirrored by scale
+                va->push_back(toVec3(v0)); va->push_back(toVec3(v1)); va->push_back(toVec3(v2));
+                for (int k = 0; k < 3; ++k) na->push_back(toVec3(normal));
+            }
+        }
+        if (va->empty()) return NULL;
+        return createGeometry(va.get(), na.get(), NULL, new osg::DrawArrays(GL_TRIANGLES, 0, va->size()));
+    }
+
+    static osg::Geometry* createTriangleMeshGeometry(const PxTriangleMesh& mesh, const PxMeshScale& scale)
+    {
+        PxMat33 scaleMatrix = scale.toMat33();
+        bool flipped = scaleMatrix.getDeterminant() < 0.0f;
+        osg::ref_ptr<osg::Vec3Array> va = new osg::Vec3Array(mesh.getNbVertices());
+        for (unsigned int i = 0; i < va->size(); ++i)
+            (*va)[i] = toVec3(scaleMatrix * mesh.getVertices()[i]);
+
+        // Keep triangles front-facing if the scale mirrors the mesh
+        unsigned int second = flipped ? 2 : 1, third = flipped ? 1 : 2;
+        osg::ref_ptr<osg::DrawElements> de;
+        if (mesh.getTriangleMeshFlags()&PxTriangleMeshFlag::e16_BIT_INDICES)
+        {
+            osg::DrawElementsUShort* de16 = new osg::DrawElementsUShort(GL_TRIANGLES);
+            de = de16; de16->reserve(mesh.getNbTriangles() * 3);
+
+            const PxU16* indices = (const PxU16*)mesh.getTriangles();
+            for (unsigned int i = 0; i < mesh.getNbTriangles(); ++i)
+            {
+                de16->push_back(indices[3 * i + 0]);
+                de16->push_back(indices[3 * i + second]);
+                de16->push_back(indices[3 * i + third]);
+            }
+        }
+        else
+        {
+            osg::DrawElementsUInt* de32 = new osg::DrawElementsUInt(GL_TRIANGLES);
+            de = de32; de32->reserve(mesh.getNbTriangles() * 3);
+
+            const PxU32* indices = (const PxU32*)mesh.getTriangles();
+            for (unsigned int i = 0; i < mesh.getNbTriangles(); ++i)
+            {
+                de32->push_back(indices[3 * i + 0]);
+                de32->push_back(indices[3 * i + second]);
+                de32->push_back(indices[3 * i + third]);
+            }
+        }
+        return createGeometry(va.get(), NULL, NULL, de.get());
+    }
+
+    static osg::Drawable* createHeightFieldDrawable(const PxHeightFieldGeometry& hfGeom)
+    {
+        PxHeightField* hf = hfGeom.heightField;
+        osg::HeightField* grid = new osg::HeightField;
+        grid->allocate(hf->getNbColumns(), hf->getNbRows());
+        grid->setOrigin(osg::Vec3(0.0f, 0.0f, 0.0f));
+        grid->setXInterval(hfGeom.columnScale);
+        grid->setYInterval(hfGeom.rowScale);
+
+        float zScale = hfGeom.heightScale;
+        for (unsigned int r = 0; r < hf->getNbRows(); ++r)
+            for (unsigned int c = 0; c < hf->getNbColumns(); ++c)
+            {
+                const PxHeightFieldSample& s = hf->getSample(r, c);
+                grid->setHeight(c, r, (float)s.height * zScale);
+            }
+        return new osg::ShapeDrawable(grid);
+    }
+
+    /* GeometryDrawableCache */
+
+    GeometryDrawableCache* GeometryDrawableCache::instance()
+    {
+        static osg::ref_ptr<GeometryDrawableCache> s_registry = new GeometryDrawableCache;
+        return s_registry.get();
+    }
+
+    GeometryDrawableCache::GeometryDrawableCache()
+        : _pruneThreshold(256)
+    {
+        Engine::instance()->getPhysicsSDK()->registerDeletionListener(*this, PxDeletionEventFlag::eMEMORY_RELEASE);
+    }
+
+    GeometryDrawableCache::~GeometryDrawableCache()
+    {
+        Engine::instance()->getPhysicsSDK()->unregisterDeletionListener(*this);
+    }
+
+    osg::ref_ptr<osg::Geode> GeometryDrawableCache::getOrCreate(const PxGeometry& geom)
+    {
+        GeometryKey key(geom);
+        OpenThreads::ScopedLock<OpenThreads::Mutex> lock(_mutex);
+        GeodeMap::iterator itr = _geodes.find(key);
+        if (itr != _geodes.end()) return itr->second;
+
+        // Prune before inserting, so that the new geode is not removed before being referenced
+        if (_geodes.size() >= _pruneThreshold)
+        {
+            pruneUnlocked();
+            _pruneThreshold = osg::maximum(256u, (unsigned int)_geodes.size() * 2);
+        }
+
+        osg::ref_ptr<osg::Geode> geode = create(geom);
+        if (geode.valid()) _geodes[key] = geode;
+        return geode;
+    }
+
+    unsigned int GeometryDrawableCache::prune()
+    {
+        OpenThreads::ScopedLock<OpenThreads::Mutex> lock(_mutex);
+        return pruneUnlocked();
+    }
+
+    unsigned int GeometryDrawableCache::pruneUnlocked()
+    {
+        unsigned int numRemoved = 0;
+        for (GeodeMap::iterator itr = _geodes.begin(); itr != _geodes.end();)
+        {
+            if (itr->second->referenceCount() == 1) { _geodes.erase(itr++); numRemoved++; }
+            else ++itr;
+        }
+        return numRemoved;
+    }
+
+    void GeometryDrawableCache::remove(const void* meshOrHeightField)
+    {
+        OpenThreads::ScopedLock<OpenThreads::Mutex> lock(_mutex);
+        for (GeodeMap::iterator itr = _geodes.begin(); itr != _geodes.end();)
+        {
+            if (itr->first.data == meshOrHeightField) _geodes.erase(itr++);
+            else ++itr;
+        }
+    }
+
+    void GeometryDrawableCache::clear()
+    {
+        OpenThreads::ScopedLock<OpenThreads::Mutex> lock(_mutex);
+        _geodes.clear();
+    }
+
+    void GeometryDrawableCache::onRelease(const PxBase* observed, void*, PxDeletionEventFlag::Enum)
+    {
+        // Compare with the same pointers as saved in keys
+        if (const PxConvexMesh* convex = observed->is<PxConvexMesh>()) remove(convex);
+        else if (const PxTriangleMesh* mesh = observed->is<PxTriangleMesh>()) remove(mesh);
+        else if (const PxHeightField* hf = observed->is<PxHeightField>()) remove(hf);
+    }
+
+    unsigned int GeometryDrawableCache::getNumEntries() const
+    {
+        OpenThreads::ScopedLock<OpenThreads::Mutex> lock(_mutex);
+        return _geodes.size();
+    }
+
+    osg::Geode* GeometryDrawableCache::create(const PxGeometry& geom)
+    {
+        osg::ref_ptr<osg::Drawable> drawable;
+        switch (geom.getType())
+        {
+        case PxGeometryType::eSPHERE:
+            {
+                const PxSphereGeometry& sphere = static_cast<const PxSphereGeometry&>(geom);
+                drawable = new osg::ShapeDrawable(new osg::Sphere(osg::Vec3(), sphere.radius));
+            }
+            break;
+        case PxGeometryType::eCAPSULE:
+            {
+                // PhysX capsules extend along the X axis, while OSG ones along the Z axis
+                const PxCapsuleGeometry& capsule = static_cast<const PxCapsuleGeometry&>(geom);
+                osg::Capsule* capsuleShape = new osg::Capsule(osg::Vec3(), capsule.radius, capsule.halfHeight * 2.0f);
+                capsuleShape->setRotation(osg::Quat(osg::PI_2, osg::Y_AXIS));
+                drawable = new osg::ShapeDrawable(capsuleShape);
+            }
+            break;
+        case PxGeometryType::eBOX:
+            {
+                const PxBoxGeometry& box = static_cast<const PxBoxGeometry&>(geom);
+                drawable = new osg::ShapeDrawable(new osg::Box(osg::Vec3(),
+                    box.halfExtents[0] * 2.0f, box.halfExtents[1] * 2.0f, box.halfExtents[2] * 2.0f));
+            }
+            break;
+        case PxGeometryType::eCONVEXMESH:
+            {
+                const PxConvexMeshGeometry& convex = static_cast<const PxConvexMeshGeometry&>(geom);
+                if (convex.convexMesh) drawable = createConvexMeshGeometry(*convex.convexMesh, convex.scale);
+            }
+            break;
+        case PxGeometryType::eTRIANGLEMESH:
+            {
+                const PxTriangleMeshGeometry& mesh = static_cast<const PxTriangleMeshGeometry&>(geom);
+                if (mesh.triangleMesh) drawable = createTriangleMeshGeometry(*mesh.triangleMesh, mesh.scale);
+            }
+            break;
+        case PxGeometryType::eHEIGHTFIELD:
+            {
+                const PxHeightFieldGeometry& hf = static_cast<const PxHeightFieldGeometry&>(geom);
+                if (hf.heightField) drawable = createHeightFieldDrawable(hf);
+            }
+            break;
+        default:  // planes are infinite, so nothing to draw
+            break;
+        }
+        if (!drawable) return NULL;
+
+        osg::ref_ptr<osg::Geode> geode = new osg::Geode;
+        geode->addDrawable(drawable.get());
+        return geode.release();
+    }
+
 }
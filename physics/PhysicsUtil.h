@@ -6,6 +6,7 @@
 #include <osg/Geometry>
 #include <osg/Geode>
 #include <osg/Transform>
+#include <OpenThreads/Mutex>
 #include "Engine.h"
 
 namespace osgPhysics
@@ -22,6 +23,15 @@ namespace osgPhysics
     /** Convert Physics matrix to OpenSceneGraph matrix */
     extern osg::Matrix toMatrix(const physx::PxMat44& pmatrix);
 
+    /** Convert physics pose to OpenSceneGraph matrix directly, without a PxMat44 in between */
+    extern osg::Matrix toMatrix(const physx::PxTransform& pose);
+
+    /** Convert an array of physics poses to OpenSceneGraph matrices, 4 at a time with SSE2/AVX if available */
+    extern void toMatrices(const physx::PxTransform* poses, osg::Matrix* matrices, unsigned int count);
+
+    /** Blend two physics poses (linear position, spherical rotation) and convert to OpenSceneGraph matrix */
+    extern osg::Matrix toMatrix(const physx::PxTransform& t0, const physx::PxTransform& t1, double alpha);
+
     /** Cook and create new convex mesh */
     extern physx::PxConvexMesh* createConvexMesh(
         const std::vector<physx::PxVec3>& verts,
@@ -31,14 +41,16 @@ namespace osgPhysics
 #endif
     );
 
-    /** Cook and create new convex mesh from node */
+    /** Cook and create new convex mesh from node, collecting geodes in parallel chunks of about the max vertex
+        number if a CPU dispatcher is set
+    */
     extern physx::PxConvexMesh* createConvexMesh(
         osg::Node& node,
         physx::PxConvexFlags flags = physx::PxConvexFlag::eCOMPUTE_CONVEX
 #if !(PX_PHYSICS_VERSION_MAJOR > 3)
         | physx::PxConvexFlag::eINFLATE_CONVEX
 #endif
-    );
+        , physx::PxCpuDispatcher* dispatcher = 0, unsigned int verticesPerChunk = 65536);
 
     /** Cook and create new height field, where lowerTriangleData & upperTriangleData contain material index data
         and hole flag of the lower/upper triangle of each height field cell
@@ -53,12 +65,26 @@ namespace osgPhysics
     /** Cook and create new convex mesh as a cylinder */
     extern physx::PxConvexMesh* createCylinderMesh(const osg::Vec3& c, float radius, float width, unsigned int samples);
 
-    /** Cook and create new physics triangle mesh */
+    /** Cook and create new physics triangle mesh, with the given cooking object or the engine's one if NULL */
     extern physx::PxTriangleMesh* createTriangleMesh(const std::vector<physx::PxVec3>& verts,
-        const std::vector<physx::PxU32>& indices);
+        const std::vector<physx::PxU32>& indices, physx::PxCooking* cooking = 0);
 
-    /** Cook and create new physics triangle mesh from node */
-    extern physx::PxTriangleMesh* createTriangleMesh(osg::Node& node);
+    /** Cook and create new physics triangle mesh from node. If a CPU dispatcher is set, geodes are collected
+        and welded in parallel chunks of about the max vertex number, which are then merged into one mesh
+    */
+    extern physx::PxTriangleMesh* createTriangleMesh(osg::Node& node, physx::PxCpuDispatcher* dispatcher = 0,
+                                                     unsigned int verticesPerChunk = 65536);
+
+    class CookingPool;
+
+    /** Cook and create triangle meshes from node in parallel, one for each chunk of geodes with about the max
+        vertex number. Meshes are appended to the list and the number of them is returned. It blocks until all
+        chunks are cooked, so call it from a loading thread to keep the main thread responsive.
+        Concurrent chunks cook with their own cooking objects of the pool, or of a temporary pool with parameters
+        of the engine's cooking object if NULL
+    */
+    extern unsigned int createTriangleMeshes(osg::Node& node, std::vector<physx::PxTriangleMesh*>& meshes,
+        physx::PxCpuDispatcher* dispatcher, unsigned int verticesPerChunk = 65536, CookingPool* pool = 0);
 
     /** Cook and create new physics cloth fabric */
 #if !(PX_PHYSICS_VERSION_MAJOR > 3)
@@ -67,10 +93,13 @@ namespace osgPhysics
         const osg::Vec3& gravity);
 #endif
 
-    /** Create a physics scene */
+    /** Create a physics scene. A default CPU dispatcher of numThreads workers is created for the scene,
+        unless an existing dispatcher (e.g., from Engine::getOrCreateCpuDispatcher()) is specified
+    */
     extern physx::PxScene* createScene(const osg::Vec3& gravity,
         const physx::PxSimulationFilterShader& filter = &physx::PxDefaultSimulationFilterShader,
-        physx::PxSceneFlags flags = physx::PxSceneFlags(), unsigned int numThreads = 1, bool useGPU = false);
+        physx::PxSceneFlags flags = physx::PxSceneFlags(), unsigned int numThreads = 1, bool useGPU = false,
+        physx::PxCpuDispatcher* dispatcher = 0);
 
     /** Create a physics actor (static if density is 0) */
     extern physx::PxRigidActor* createActor(const physx::PxGeometry& geom, double density, physx::PxMaterial* mtl = 0);
@@ -99,31 +128,124 @@ namespace osgPhysics
     /** Create a static triangle mesh actor */
     extern physx::PxRigidActor* createTriangleMeshActor(physx::PxTriangleMesh* mesh, physx::PxMaterial* mtl = 0);
 
+    /** Create a static actor with one triangle mesh shape for each chunk of the node, see createTriangleMeshes() */
+    extern physx::PxRigidActor* createTriangleMeshActor(osg::Node& node, physx::PxCpuDispatcher* dispatcher,
+        physx::PxMaterial* mtl = 0, unsigned int verticesPerChunk = 65536, CookingPool* pool = 0);
+
     /** Create a static ground plane actor */
     extern physx::PxRigidActor* createPlaneActor(const osg::Plane& plane, physx::PxMaterial* mtl = 0);
 
     /** Set simulation filter for a certain actor */
     extern bool createSimulationFilter(physx::PxRigidActor* actor, const physx::PxFilterData& filter);
 
-    /** Create a node for specified actor */
+    /** Create a node for specified actor: a transform of its global pose with geodes of its shapes, which are shared
+        with other actors through GeometryDrawableCache. Set render states on the returned node, not on the geodes.
+        Planes are infinite and have no geodes
+    */
     extern osg::Node* createNodeForActor(physx::PxRigidActor* actor);
 
     /** Convenient function to create geometry */
     extern osg::Geometry* createGeometry(osg::Vec3Array* va, osg::Vec3Array* na, osg::Vec2Array* ta,
         osg::PrimitiveSet* p, bool useVBO = true);
 
+    /** Identity of a PhysX geometry: primitive dimensions, or the mesh (or height field) pointer with its scale */
+    struct GeometryKey
+    {
+        physx::PxGeometryType::Enum type;
+        const void* data;
+        float params[7];
+
+        GeometryKey(const physx::PxGeometry& geom);
+        bool operator<(const GeometryKey& rhs) const;
+
+    protected:
+        void setMeshScale(const physx::PxMeshScale& scale);
+    };
+
+    /** The global cache of geodes of PhysX geometries used by createNodeForActor(), so that memory and GPU buffers
+        grow with unique geometries instead of actors. Mesh scales are applied to vertices, and geodes are in local
+        space of shapes. Entries of a mesh or height field are removed automatically when PhysX frees its memory,
+        as the address may then be reused by a new one. Entries used by no node any more (e.g., of primitives with
+        varied sizes) are pruned whenever the number of entries doubles since last pruning
+    */
+    class GeometryDrawableCache : public osg::Referenced, public physx::PxDeletionListener
+    {
+    public:
+        static GeometryDrawableCache* instance();
+
+        /** Get or create the shared geode of the geometry, NULL if not supported. Keep the result referenced,
+            otherwise it may be pruned
+        */
+        osg::ref_ptr<osg::Geode> getOrCreate(const physx::PxGeometry& geom);
+
+        /** Remove geodes only referenced by the cache, returns the number of removed ones */
+        unsigned int prune();
+
+        /** Remove geodes of the mesh or height field with all scales */
+        void remove(const void* meshOrHeightField);
+        void clear();
+
+        unsigned int getNumEntries() const;
+
+        /** Called by PhysX when memory of an object is released, to evict geodes of meshes and height fields */
+        virtual void onRelease(const physx::PxBase* observed, void* userData,
+                               physx::PxDeletionEventFlag::Enum deletionEvent);
+
+    protected:
+        GeometryDrawableCache();
+        virtual ~GeometryDrawableCache();
+
+        osg::Geode* create(const physx::PxGeometry& geom);
+
+        unsigned int pruneUnlocked();
+
+        typedef std::map<GeometryKey, osg::ref_ptr<osg::Geode> > GeodeMap;
+        GeodeMap _geodes;
+        unsigned int _pruneThreshold;
+        mutable OpenThreads::Mutex _mutex;
+    };
+
+    /** An open addressing hash table mapping vertices to indices for welding. If epsilon is positive, positions
+        are quantized to cells of that size and vertices in the same cell are welded, otherwise only equal ones are
+    */
+    class VertexHashMap
+    {
+    public:
+        VertexHashMap(float epsilon = 0.0f);
+
+        void setEpsilon(float epsilon);
+        float getEpsilon() const { return _epsilon; }
+
+        /** Reserve capacity for the number of vertices, so that no rehashing happens until exceeding it */
+        void reserve(unsigned int numVertices);
+
+        /** Find index of the vertex, or insert it with newIndex if not existing. Only probes the table once */
+        unsigned int insertOrGet(const osg::Vec3& v, unsigned int newIndex, bool& inserted);
+
+        unsigned int size() const { return _size; }
+        void clear();
+
+    protected:
+        struct Entry { physx::PxI64 key[3]; unsigned int index; };
+        void makeKey(const osg::Vec3& v, physx::PxI64* key) const;
+        void rehash(unsigned int capacity);
+
+        std::vector<Entry> _entries;
+        unsigned int _size, _mask;
+        float _epsilon, _invEpsilon;
+    };
+
     /** A visitor for collecting vital geometry data (vertices and indices) in the node subgraph */
     struct GeometryDataCollector : public osg::NodeVisitor
     {
-        GeometryDataCollector();
+        GeometryDataCollector(float weldEpsilon = 0.0f);
         virtual void apply(osg::Transform& transform);
         virtual void apply(osg::Geode& node);
 
         inline void pushMatrix(osg::Matrix& matrix) { matrixStack.push_back(matrix); }
         inline void popMatrix() { matrixStack.pop_back(); }
 
-        typedef std::map<osg::Vec3, unsigned int> VertexMap;
-        VertexMap vertexMap;
+        VertexHashMap vertexMap;
         std::vector<osg::Vec3> vertices;
 
         struct GeometryFace { unsigned int indices[4]; };
@@ -136,18 +258,53 @@ namespace osgPhysics
         MatrixStack matrixStack;
     };
 
-    /** The memory output stream class */
+    /** A pool of cooking objects with the same parameters, as PhysX cooking is only thread-safe per instance.
+        Each concurrent cooking call acquires its own object, which is kept for reuse after being released
+    */
+    class CookingPool : public osg::Referenced
+    {
+    public:
+        CookingPool(const physx::PxCookingParams& params);
+
+        physx::PxCooking* acquire();
+        void release(physx::PxCooking* cooking);
+
+        const physx::PxCookingParams& getParams() const { return _params; }
+        unsigned int getNumCreated() const { return _numCreated; }
+
+    protected:
+        virtual ~CookingPool();
+
+        std::vector<physx::PxCooking*> _freeCookings;
+        physx::PxCookingParams _params;
+        unsigned int _numCreated;
+        OpenThreads::Mutex _mutex;
+    };
+
+    /** The memory output stream class, which grows geometrically. It can be reset and reused for many cooking
+        calls without reallocating its memory, as the cooking functions here do with a shared pool of streams
+    */
     class MemoryOutputStream : public physx::PxOutputStream
     {
     public:
-        MemoryOutputStream();
+        MemoryOutputStream(physx::PxU32 sizeHint = 0);
         virtual ~MemoryOutputStream();
 
         virtual physx::PxU32 write(const void* src, physx::PxU32 count);
         physx::PxU32 getSize() const { return _size; }
         physx::PxU8* getData() const { return _data; }
 
+        /** Make sure the capacity is at least the given size */
+        void reserve(physx::PxU32 capacity);
+        physx::PxU32 getCapacity() const { return _capacity; }
+
+        /** Discard written data but keep allocated memory for next use */
+        void reset() { _size = 0; }
+
     private:
+        MemoryOutputStream(const MemoryOutputStream&);
+        MemoryOutputStream& operator=(const MemoryOutputStream&);
+
         physx::PxU8* _data;
         physx::PxU32 _size;
         physx::PxU32 _capacity;
@@ -171,6 +328,47 @@ namespace osgPhysics
         physx::PxU32 _pos;
     };
 
+    /** The input data reading a file through a read-only memory mapping, without copying it first.
+        It falls back to reading the whole file into memory if mapping is not available.
+        A copy-on-write mapping can also be opened, for deserializing in place without modifying the file
+    */
+    class MappedFileInputData : public physx::PxInputData
+    {
+    public:
+        MappedFileInputData();
+        MappedFileInputData(const std::string& fileName);
+        virtual ~MappedFileInputData();
+
+        bool open(const std::string& fileName, bool copyOnWrite = false);
+        void close();
+        bool isOpened() const { return _base != NULL; }
+
+        /** Restrict reading to a range of the file, for example to skip a custom header */
+        bool setRange(physx::PxU32 offset, physx::PxU32 length);
+
+        /** Obtain the whole file content */
+        const physx::PxU8* getFileData() const { return _base; }
+        physx::PxU32 getFileSize() const { return _fileSize; }
+
+        /** Obtain the whole file content (aligned to 128 bytes) for modifying, only if opened as copy-on-write */
+        physx::PxU8* getWritableFileData() { return _copyOnWrite ? const_cast<physx::PxU8*>(_base) : NULL; }
+
+        virtual physx::PxU32 read(void* dest, physx::PxU32 count);
+        virtual void seek(physx::PxU32 pos);
+        virtual physx::PxU32 getLength() const { return _length; }
+        virtual physx::PxU32 tell() const { return _pos; }
+
+    private:
+        MappedFileInputData(const MappedFileInputData&);
+        MappedFileInputData& operator=(const MappedFileInputData&);
+
+        std::vector<char> _buffer;
+        const physx::PxU8 *_base, *_data;
+        physx::PxU32 _fileSize, _length, _pos;
+        void *_fileHandle, *_mappingHandle;
+        bool _copyOnWrite;
+    };
+
 }
 
 #endif
@@ -0,0 +1,222 @@
+#include <osgViewer/ViewerEventHandlers>
+#include "Profiler.h"
+#include <algorithm>
+#include <fstream>
+#include <math.h>
+#include <iostream>
+
+using namespace osgPhysics;
+using namespace physx;
+
+static const char* s_phaseNames[Profiler::NUM_PHASES] =
+{
+    "simulate", "fetch", "vehicle raycasts", "vehicle updates",
+    "character move", "particle readback", "transform sync"
+};
+
+Profiler::SimulationCounts::SimulationCounts()
+    : activeDynamicBodies(0), activeKinematicBodies(0), staticBodies(0), activeConstraints(0),
+    pairs(0), pairsWithContacts(0), newPairs(0), lostPairs(0)
+{
+}
+
+Profiler::Record::Record()
+    : index(0), numFrames(0), hasCounts(false)
+{
+    for (int i = 0; i < NUM_PHASES; ++i) current[i] = 0.0;
+}
+
+Profiler* Profiler::instance()
+{
+    static osg::ref_ptr<Profiler> s_registry = new Profiler;
+    return s_registry.get();
+}
+
+Profiler::Profiler()
+    : _historySize(300), _lastEndedFrame(~0u), _enabled(false)
+{
+    for (int i = 0; i < NUM_PHASES; ++i) _lastFrameTimes[i] = 0.0;
+}
+
+const char* Profiler::getPhaseName(Phase p)
+{
+    return (p < NUM_PHASES) ? s_phaseNames[p] : "";
+}
+
+std::string Profiler::getStatsAttributeName(Phase p)
+{
+    return std::string("Physics ") + getPhaseName(p) + " time taken";
+}
+
+void Profiler::setHistorySize(unsigned int n)
+{
+    _historySize = n > 0 ? n : 1;
+    clear();
+}
+
+void Profiler::addTime(Phase p, double ms, PxScene* scene)
+{
+    if (!_enabled || p >= NUM_PHASES) return;
+    _records[scene].current[p] += ms;
+}
+
+void Profiler::recordSimulationCounts(PxScene* scene)
+{
+    if (!_enabled || !scene) return;
+    PxSimulationStatistics statistics;
+    scene->getSimulationStatistics(statistics);
+
+    Record& record = _records[scene];
+    record.counts.activeDynamicBodies = statistics.nbActiveDynamicBodies;
+    record.counts.activeKinematicBodies = statistics.nbActiveKinematicBodies;
+    record.counts.staticBodies = statistics.nbStaticBodies;
+    record.counts.activeConstraints = statistics.nbActiveConstraints;
+    record.counts.pairs = statistics.nbDiscreteContactPairsTotal;
+    record.counts.pairsWithContacts = statistics.nbDiscreteContactPairsWithContacts;
+    record.counts.newPairs = statistics.nbNewPairs;
+    record.counts.lostPairs = statistics.nbLostPairs;
+    record.hasCounts = true;
+}
+
+void Profiler::endFrame(unsigned int frameNumber)
+{
+    if (!_enabled) return;
+    for (int i = 0; i < NUM_PHASES; ++i) _lastFrameTimes[i] = 0.0;
+
+    for (RecordMap::iterator itr = _records.begin(); itr != _records.end(); ++itr)
+    {
+        Record& record = itr->second;
+        for (int i = 0; i < NUM_PHASES; ++i)
+        {
+            std::vector<double>& history = record.history[i];
+            if (history.size() != _historySize) history.resize(_historySize, 0.0);
+            history[record.index] = record.current[i];
+            _lastFrameTimes[i] += record.current[i];
+            record.current[i] = 0.0;
+        }
+        record.index = (record.index + 1) % _historySize;
+        if (record.numFrames < _historySize) record.numFrames++;
+    }
+
+    if (_stats.valid())
+    {
+        for (int i = 0; i < NUM_PHASES; ++i)
+        {
+            // Stats handler shows time taken in seconds, with a multiplier of 1000 for milliseconds
+            _stats->setAttribute(frameNumber, getStatsAttributeName((Phase)i), _lastFrameTimes[i] * 0.001);
+        }
+    }
+}
+
+bool Profiler::endFrameOnce(unsigned int frameNumber)
+{
+    if (frameNumber == _lastEndedFrame) return false;
+    _lastEndedFrame = frameNumber;
+    endFrame(frameNumber);
+    return true;
+}
+
+bool Profiler::getStatistics(Phase p, PhaseStatistics& stats, PxScene* scene) const
+{
+    RecordMap::const_iterator itr = _records.find(scene);
+    if (itr == _records.end() || p >= NUM_PHASES || !itr->second.numFrames) return false;
+
+    const Record& record = itr->second;
+    std::vector<double> values(record.history[p].begin(), record.history[p].begin() + record.numFrames);
+    double sum = 0.0;
+    stats.minimum = values[0]; stats.maximum = values[0];
+    for (unsigned int i = 0; i < values.size(); ++i)
+    {
+        sum += values[i];
+        stats.minimum = std::min(stats.minimum, values[i]);
+        stats.maximum = std::max(stats.maximum, values[i]);
+    }
+    stats.average = sum / values.size();
+    stats.numFrames = values.size();
+
+    unsigned int rank = (unsigned int)ceil(values.size() * 0.99) - 1;
+    std::nth_element(values.begin(), values.begin() + rank, values.end());
+    stats.p99 = values[rank];
+    return true;
+}
+
+double Profiler::getLastFrameTime(Phase p) const
+{
+    return (p < NUM_PHASES) ? _lastFrameTimes[p] : 0.0;
+}
+
+bool Profiler::getSimulationCounts(PxScene* scene, SimulationCounts& counts) const
+{
+    RecordMap::const_iterator itr = _records.find(scene);
+    if (itr == _records.end() || !itr->second.hasCounts) return false;
+    counts = itr->second.counts; return true;
+}
+
+void Profiler::removeRecords(PxScene* scene)
+{
+    _records.erase(scene);
+}
+
+void Profiler::clear()
+{
+    _records.clear();
+    for (int i = 0; i < NUM_PHASES; ++i) _lastFrameTimes[i] = 0.0;
+}
+
+std::string Profiler::getSceneName(PxScene* scene) const
+{
+    if (!scene) return "all";
+    const Engine::SceneMap& scenes = Engine::instance()->getSceneMap();
+    for (Engine::SceneMap::const_iterator itr = scenes.begin(); itr != scenes.end(); ++itr)
+    { if (itr->second == scene) return itr->first; }
+    return "unknown";
+}
+
+bool Profiler::writeCSV(const std::string& file) const
+{
+    std::ofstream out(file.c_str());
+    if (!out)
+    {
+        OSG_WARN << "[Profiler] Failed to write " << file << std::endl;
+        return false;
+    }
+
+    // Counts are written as metrics with the same min/avg/max/p99 values
+    out << "scene,metric,frames,min,avg,max,p99" << std::endl;
+    for (RecordMap::const_iterator itr = _records.begin(); itr != _records.end(); ++itr)
+    {
+        std::string name = getSceneName(itr->first);
+        for (int i = 0; i < NUM_PHASES; ++i)
+        {
+            PhaseStatistics stats;
+            if (!getStatistics((Phase)i, stats, itr->first)) continue;
+            out << name << "," << getPhaseName((Phase)i) << " ms," << stats.numFrames << ","
+                << stats.minimum << "," << stats.average << "," << stats.maximum << "," << stats.p99 << std::endl;
+        }
+
+        if (!itr->second.hasCounts) continue;
+        const SimulationCounts& c = itr->second.counts;
+        const char* countNames[] = { "active dynamic bodies", "active kinematic bodies", "static bodies",
+                                     "active constraints", "pairs", "pairs with contacts", "new pairs", "lost pairs" };
+        unsigned int counts[] = { c.activeDynamicBodies, c.activeKinematicBodies, c.staticBodies,
+                                  c.activeConstraints, c.pairs, c.pairsWithContacts, c.newPairs, c.lostPairs };
+        for (int i = 0; i < 8; ++i)
+        {
+            out << name << "," << countNames[i] << ",1," << counts[i] << "," << counts[i] << ","
+                << counts[i] << "," << counts[i] << std::endl;
+        }
+    }
+    return true;
+}
+
+void Profiler::addStatsLines(osgViewer::StatsHandler* handler)
+{
+    if (!handler) return;
+    osg::Vec4 textColor(0.8f, 1.0f, 0.6f, 1.0f), barColor(0.4f, 0.8f, 0.2f, 0.5f);
+    for (int i = 0; i < NUM_PHASES; ++i)
+    {
+        std::string label = std::string("Physics ") + getPhaseName((Phase)i) + ": ";
+        handler->addUserStatsLine(label, textColor, barColor, getStatsAttributeName((Phase)i),
+                                  1000.0, true, false, "", "", 10.0);
+    }
+}
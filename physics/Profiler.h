@@ -0,0 +1,144 @@
+#ifndef PHYSICS_PROFILER
+#define PHYSICS_PROFILER
+
+#include <osg/Referenced>
+#include <osg/observer_ptr>
+#include <osg/Timer>
+#include <osg/Stats>
+#include "Engine.h"
+
+namespace osgViewer
+{
+    class StatsHandler;
+}
+
+namespace osgPhysics
+{
+
+    /** The global profiler recording per-phase physics timings of every frame, which keeps rolling statistics
+        of the latest frames for each scene. It is disabled by default and should only be used in the update thread
+    */
+    class Profiler : public osg::Referenced
+    {
+    public:
+        static Profiler* instance();
+
+        enum Phase
+        {
+            SIMULATE = 0, FETCH_RESULTS, VEHICLE_RAYCASTS, VEHICLE_UPDATES,
+            CHARACTER_MOVE, PARTICLE_READBACK, TRANSFORM_SYNC, NUM_PHASES
+        };
+        static const char* getPhaseName(Phase p);
+
+        /** Rolling statistics of a phase in milliseconds */
+        struct PhaseStatistics
+        {
+            double minimum, average, maximum, p99;
+            unsigned int numFrames;
+            PhaseStatistics() : minimum(0.0), average(0.0), maximum(0.0), p99(0.0), numFrames(0) {}
+        };
+
+        /** Counts from PxSimulationStatistics of the last step */
+        struct SimulationCounts
+        {
+            unsigned int activeDynamicBodies, activeKinematicBodies, staticBodies, activeConstraints;
+            unsigned int pairs, pairsWithContacts, newPairs, lostPairs;
+            SimulationCounts();
+        };
+
+        void setEnabled(bool b) { _enabled = b; }
+        bool getEnabled() const { return _enabled; }
+
+        /** Set number of latest frames to compute statistics from */
+        void setHistorySize(unsigned int n);
+        unsigned int getHistorySize() const { return _historySize; }
+
+        /** Set the stats object (usually of the viewer) to report phase times of every ended frame to */
+        void setStats(osg::Stats* stats) { _stats = stats; }
+        osg::Stats* getStats() { return _stats.get(); }
+
+        /** Add time (in milliseconds) to a phase of current frame, a NULL scene means not scene specific */
+        void addTime(Phase p, double ms, physx::PxScene* scene = NULL);
+
+        /** Read simulation statistics of the scene, must be called after fetching results */
+        void recordSimulationCounts(physx::PxScene* scene);
+
+        /** End current frame and push its timings into the history */
+        void endFrame(unsigned int frameNumber = 0);
+
+        /** End the viewer frame of the number unless it is already ended, so that the history still advances once
+            per frame if the application also ends frames with their numbers besides the system updater.
+            Returns false if skipped
+        */
+        bool endFrameOnce(unsigned int frameNumber);
+
+        /** Obtain rolling statistics of a phase */
+        bool getStatistics(Phase p, PhaseStatistics& stats, physx::PxScene* scene = NULL) const;
+
+        /** Obtain total time of a phase in last ended frame, of all scenes */
+        double getLastFrameTime(Phase p) const;
+
+        /** Obtain simulation counts of last step of the scene */
+        bool getSimulationCounts(physx::PxScene* scene, SimulationCounts& counts) const;
+
+        /** Remove records of the scene, called when it is removed from the engine */
+        void removeRecords(physx::PxScene* scene);
+        void clear();
+
+        /** Write statistics of all scenes and phases, and simulation counts, as comma separated values */
+        bool writeCSV(const std::string& file) const;
+
+        /** Add lines of all phases to the stats handler, working together with setStats() */
+        static void addStatsLines(osgViewer::StatsHandler* handler);
+
+        /** Attribute name used in osg::Stats of the phase */
+        static std::string getStatsAttributeName(Phase p);
+
+    protected:
+        Profiler();
+        virtual ~Profiler() {}
+
+        struct Record
+        {
+            double current[NUM_PHASES];
+            std::vector<double> history[NUM_PHASES];
+            SimulationCounts counts;
+            unsigned int index, numFrames;
+            bool hasCounts;
+            Record();
+        };
+
+        std::string getSceneName(physx::PxScene* scene) const;
+
+        typedef std::map<physx::PxScene*, Record> RecordMap;
+        RecordMap _records;
+        osg::observer_ptr<osg::Stats> _stats;
+        double _lastFrameTimes[NUM_PHASES];
+        unsigned int _historySize, _lastEndedFrame;
+        bool _enabled;
+    };
+
+    /** Add elapsed time of current scope to the profiler phase */
+    class ProfileScope
+    {
+    public:
+        ProfileScope(Profiler::Phase p, physx::PxScene* s = NULL)
+            : _phase(p), _scene(s), _enabled(Profiler::instance()->getEnabled())
+        { if (_enabled) _start = osg::Timer::instance()->tick(); }
+
+        ~ProfileScope()
+        {
+            if (_enabled) Profiler::instance()->addTime(
+                _phase, osg::Timer::instance()->delta_m(_start, osg::Timer::instance()->tick()), _scene);
+        }
+
+    protected:
+        Profiler::Phase _phase;
+        physx::PxScene* _scene;
+        osg::Timer_t _start;
+        bool _enabled;
+    };
+
+}
+
+#endif
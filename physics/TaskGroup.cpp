@@ -0,0 +1,69 @@
+#include "TaskGroup.h"
+
+using namespace osgPhysics;
+using namespace physx;
+
+namespace osgPhysics
+{
+
+    class TaskGroupTask : public PxBaseTask
+    {
+    public:
+        TaskGroupTask(TaskGroup* g) : _group(g), _job(NULL) {}
+        void setJob(TaskGroup::Job* job) { _job = job; }
+
+        virtual void run() { _job->run(); }
+        virtual const char* getName() const { return "osgPhysics.TaskGroup"; }
+        virtual void addReference() {}
+        virtual void removeReference() {}
+        virtual PxI32 getReference() const { return 1; }
+        virtual void release() { _group->jobFinished(); }
+
+    protected:
+        TaskGroup* _group;
+        TaskGroup::Job* _job;
+    };
+
+}
+
+TaskGroup::TaskGroup()
+    : _numRemainingJobs(0)
+{
+}
+
+TaskGroup::~TaskGroup()
+{
+    for (unsigned int i = 0; i < _tasks.size(); ++i) delete _tasks[i];
+}
+
+void TaskGroup::run(PxCpuDispatcher* dispatcher, Job** jobs, unsigned int numJobs)
+{
+    if (!numJobs) return;
+    if (!dispatcher || numJobs == 1)
+    {
+        for (unsigned int i = 0; i < numJobs; ++i) jobs[i]->run();
+        return;
+    }
+
+    while (_tasks.size() < numJobs) _tasks.push_back(new TaskGroupTask(this));
+    {
+        OpenThreads::ScopedLock<OpenThreads::Mutex> lock(_mutex);
+        _numRemainingJobs = numJobs - 1;
+    }
+
+    for (unsigned int i = 1; i < numJobs; ++i)
+    {
+        _tasks[i]->setJob(jobs[i]);
+        dispatcher->submitTask(*_tasks[i]);
+    }
+    jobs[0]->run();
+
+    OpenThreads::ScopedLock<OpenThreads::Mutex> lock(_mutex);
+    while (_numRemainingJobs > 0) _condition.wait(&_mutex);
+}
+
+void TaskGroup::jobFinished()
+{
+    OpenThreads::ScopedLock<OpenThreads::Mutex> lock(_mutex);
+    if (_numRemainingJobs > 0 && --_numRemainingJobs == 0) _condition.broadcast();
+}
@@ -0,0 +1,44 @@
+#ifndef PHYSICS_TASKGROUP
+#define PHYSICS_TASKGROUP
+
+#include <OpenThreads/Mutex>
+#include <OpenThreads/Condition>
+#include "Engine.h"
+
+namespace osgPhysics
+{
+
+    class TaskGroupTask;
+
+    /** Run a number of independent jobs on a PhysX CPU dispatcher and wait for all of them.
+        The calling thread runs the first job itself, or all of them if there is no dispatcher
+    */
+    class TaskGroup
+    {
+    public:
+        class Job
+        {
+        public:
+            virtual ~Job() {}
+            virtual void run() = 0;
+        };
+
+        TaskGroup();
+        ~TaskGroup();
+
+        /** Run all jobs and return after they are finished */
+        void run(physx::PxCpuDispatcher* dispatcher, Job** jobs, unsigned int numJobs);
+
+        /** Called by tasks when their jobs are done */
+        void jobFinished();
+
+    protected:
+        std::vector<TaskGroupTask*> _tasks;
+        OpenThreads::Mutex _mutex;
+        OpenThreads::Condition _condition;
+        unsigned int _numRemainingJobs;
+    };
+
+}
+
+#endif
@@ -145,7 +145,7 @@ void WheeledVehicle::WheelData::computeParameters(const ChassisData& chassis, bo
 
 WheeledVehicle::WheeledVehicle(int numWheels)
     : _chassisShape(NULL), _actor(NULL), _reverseMode(false), _movingForwardSlowly(false),
-    _analogMode(false), _allowControllers(true)
+    _analogMode(false), _allowControllers(true), _componentPosesValid(false)
 {
     VehicleManager::instance();
     _speedTable = PxFixedSizeLookupTable<8>(g_speedDataTable, 4);
@@ -163,6 +163,10 @@ void WheeledVehicle::resetPose(const PxTransform& startTransform)
     actor->setGlobalPose(startTransform);
     _reverseMode = false;
     _movingForwardSlowly = false;
+
+    // Don't blend from poses before the reset
+    _componentPosesValid = false;
+    updateComponentPoses();
 }
 
 void WheeledVehicle::setSpeedTable(const std::vector<float>& table, unsigned int numUsed)
@@ -172,14 +176,29 @@ void WheeledVehicle::setSpeedTable(const std::vector<float>& table, unsigned int
 
 unsigned int WheeledVehicle::getComponentTransforms(std::vector<PxTransform>& transforms) const
 {
-    std::vector<PxShape*> shapes(_actor->getNbShapes());
-    unsigned int size = _actor->getShapes(&(shapes[0]), _actor->getNbShapes());
+    const PxTransform pose = _actor->getGlobalPose();
+    unsigned int size = _componentShapes.size();
+    for (unsigned int i = 0; i < size; ++i)
+        transforms.push_back(pose * _componentShapes[i]->getLocalPose());
+    return size;
+}
+
+void WheeledVehicle::updateComponentPoses()
+{
+    if (!_actor) return;
+    _previousComponentPoses.swap(_componentPoses);
+
+    // Same as PxShapeExt::getGlobalPose(), but with the chassis pose computed only once
+    const PxTransform pose = _actor->getGlobalPose();
+    unsigned int size = _componentShapes.size();
     for (unsigned int i = 0; i < size; ++i)
+        _componentPoses[i] = pose * _componentShapes[i]->getLocalPose();
+
+    if (!_componentPosesValid)
     {
-        PxTransform t = PxShapeExt::getGlobalPose(*(shapes[i]), *_actor);
-        transforms.push_back(t);
+        _previousComponentPoses = _componentPoses;
+        _componentPosesValid = true;
     }
-    return size;
 }
 
 double WheeledVehicle::computeRotationSpeed() const
@@ -287,6 +306,13 @@ physx::PxRigidDynamic* WheeledVehicle::createActorAndFilters(
     _chassisShape->setLocalPose(PxTransform(PxIdentity));
     VehicleManager::createFilter(VehicleManager::FILTER_UNDRIVABLE_SURFACE, _chassisShape);
     VehicleManager::createFilter(VehicleManager::FILTER_CHASSIS, _chassisShape);
+
+    // Cache all component shapes (wheels and then chassis) and buffers for updating their poses
+    _componentShapes.resize(actor->getNbShapes());
+    actor->getShapes(&(_componentShapes[0]), _componentShapes.size());
+    _componentPoses.assign(_componentShapes.size(), PxTransform(PxIdentity));
+    _previousComponentPoses = _componentPoses;
+    _componentPosesValid = false;
     return actor;
 }
 
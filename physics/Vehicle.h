@@ -118,6 +118,15 @@ namespace osgPhysics
         /** Obtain global pose of every part of the car (usually 4 wheels and the chassis) */
         unsigned int getComponentTransforms(std::vector<physx::PxTransform>& transforms) const;
 
+        /** Recompute cached global poses of all parts after a simulation step, keeping the last ones as previous.
+            This is done by UpdatePhysicsSystemCallback for every registered vehicle, without any allocation
+        */
+        void updateComponentPoses();
+
+        /** Get cached component poses of the latest and the one before latest simulation steps */
+        const std::vector<physx::PxTransform>& getComponentPoses() const { return _componentPoses; }
+        const std::vector<physx::PxTransform>& getPreviousComponentPoses() const { return _previousComponentPoses; }
+
         /** Compute the speed of the car */
         double computeForwardSpeed() const { return _drive->computeForwardSpeed(); }
         double computeSideSpeed() const { return _drive->computeSidewaysSpeed(); }
@@ -144,6 +153,8 @@ namespace osgPhysics
         physx::PxRigidDynamic* _actor;
         physx::PxVehicleDrive* _drive;
         std::vector<physx::PxShape*> _wheelShapes;
+        std::vector<physx::PxShape*> _componentShapes;
+        std::vector<physx::PxTransform> _componentPoses, _previousComponentPoses;
 
         std::vector<physx::PxWheelQueryResult> _wheelQueryResult;
         physx::PxVehicleWheelQueryResult _vehicleQueryResult;
@@ -151,6 +162,7 @@ namespace osgPhysics
         physx::PxFixedSizeLookupTable<8> _speedTable;
         bool _reverseMode, _movingForwardSlowly;
         bool _analogMode, _allowControllers;
+        bool _componentPosesValid;
     };
 
     /** The 4-wheeled car vehicle */
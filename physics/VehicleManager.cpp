@@ -1,6 +1,7 @@
 #include <osg/io_utils>
 #include "PhysicsUtil.h"
 #include "VehicleManager.h"
+#include "Profiler.h"
 #include <algorithm>
 #include <iostream>
 
@@ -78,6 +79,20 @@ static PxQueryHitType::Enum wheelRaycastPreFilter(
         PxQueryHitType::eNONE : PxQueryHitType::eBLOCK;
 }
 
+// Sweep filter shader, which must report touches as each wheel may use more than one hit
+static PxQueryHitType::Enum wheelSweepPreFilter(
+    PxFilterData filterData0, PxFilterData filterData1,
+    const void* constantBlock, PxU32 constantBlockSize,
+    PxSceneQueryFlags& queryFlags)
+{
+    PX_UNUSED(queryFlags);
+    PX_UNUSED(constantBlockSize);
+    PX_UNUSED(constantBlock);
+    PX_UNUSED(filterData0);
+    return ((filterData1.word3 & VehicleManager::COLLISION_FLAG_DRIVABLE_SURFACE) == 0) ?
+        PxQueryHitType::eNONE : PxQueryHitType::eTOUCH;
+}
+
 /* VehicleManager */
 
 VehicleManager* VehicleManager::instance()
@@ -87,17 +102,18 @@ VehicleManager* VehicleManager::instance()
 }
 
 VehicleManager::VehicleManager()
-    : _query(NULL), _queryResults(NULL), _queryHitBuffer(NULL), _numQueries(0), _numMaxWheels(0)
+    : _vehicleBatchSize(0), _sweepHitsPerWheel(4), _suspensionSweeps(false)
 {
     PxInitVehicleSDK(*SDK_OBJ);
+    Engine::instance()->addSceneObserver(this);
     initialize();
 }
 
 VehicleManager::~VehicleManager()
 {
-    if (_query) _query->release();
-    if (_queryResults) delete[] _queryResults;
-    if (_queryHitBuffer) delete[] _queryHitBuffer;
+    Engine::instance()->removeSceneObserver(this);
+    while (!_queryPools.empty()) releaseQueries(_queryPools.begin()->first);
+    while (!_sceneBatches.empty()) releaseQueries(_sceneBatches.begin()->first);
     _surfaceTirePairs->release();
     PxCloseVehicleSDK();
 }
@@ -145,9 +161,10 @@ PxFilterData VehicleManager::createFilter(VehicleManager::FilterType type, PxSha
     return filter;
 }
 
-PxScene* VehicleManager::createScene(const osg::Vec3& gravity)
+PxScene* VehicleManager::createScene(const osg::Vec3& gravity, PxSceneFlags flags,
+                                     unsigned int numThreads, PxCpuDispatcher* dispatcher)
 {
-    return osgPhysics::createScene(gravity, vehicleSceneFilter);
+    return osgPhysics::createScene(gravity, vehicleSceneFilter, flags, numThreads, false, dispatcher);
 }
 
 bool VehicleManager::addActor(const std::string& scene, PxActor* actor,
@@ -200,13 +217,46 @@ void VehicleManager::update(double step, const std::string& s, std::vector<PxVeh
 {
     PxScene* scene = Engine::instance()->getScene(s);
     if (!scene || step <= 0.0) return;
-    updateQueryData(scene, numWheels);
+    if (_vehicleBatchSize > 0 && vehicles.size() > _vehicleBatchSize && scene->getCpuDispatcher())
+    {
+        updateInBatches(step, scene, vehicles, queryResults);
+        return;
+    }
+    QueryPool* pool = updateQueryData(scene, numWheels);
 
     unsigned int size = vehicles.size();
-    PxVehicleSuspensionRaycasts(_query, size, &(vehicles[0]), _numQueries, _queryResults);
+    {
+        ProfileScope profile(Profiler::VEHICLE_RAYCASTS, scene);
+        pool->execute(size, &(vehicles[0]), numWheels);
+    }
+
+    ProfileScope profile(Profiler::VEHICLE_UPDATES, scene);
     PxVehicleUpdates(step, scene->getGravity(), *_surfaceTirePairs, size, &(vehicles[0]), &(queryResults[0]));
 }
 
+void VehicleManager::updateWithoutRaycasts(double step, const std::string& s, std::vector<PxVehicleWheels*>& vehicles,
+    std::vector<physx::PxVehicleWheelQueryResult>& queryResults)
+{
+    PxScene* scene = Engine::instance()->getScene(s);
+    if (!scene || step <= 0.0 || vehicles.empty()) return;
+
+    ProfileScope profile(Profiler::VEHICLE_UPDATES, scene);
+    PxVehicleUpdates(step, scene->getGravity(), *_surfaceTirePairs, vehicles.size(), &(vehicles[0]), &(queryResults[0]));
+}
+
+void VehicleManager::releaseQueries(PxScene* scene)
+{
+    std::map<PxScene*, QueryPool*>::iterator itr = _queryPools.find(scene);
+    if (itr != _queryPools.end()) { delete itr->second; _queryPools.erase(itr); }
+
+    std::map<PxScene*, VehicleBatchList>::iterator itr2 = _sceneBatches.find(scene);
+    if (itr2 != _sceneBatches.end())
+    {
+        for (unsigned int i = 0; i < itr2->second.size(); ++i) delete itr2->second[i];
+        _sceneBatches.erase(itr2);
+    }
+}
+
 void VehicleManager::initialize()
 {
     PxVehicleSetBasisVectors(PxVec3(0, 1, 0), PxVec3(0, 0, 1));
@@ -214,6 +264,9 @@ void VehicleManager::initialize()
     {
         _surfaceMaterials[i] = SDK_OBJ->createMaterial(0.2f, 0.5f, 0.5f);
         _surfaceTypes[i].mType = (PxU32)SURFACE_MUD + i;
+
+        // Keep surfaces of exported scenes pointing to the same materials, which tire frictions rely on
+        Engine::instance()->addSharedObject(*_surfaceMaterials[i], PxSerialObjectId(16 + i));
     }
 
     _surfaceTirePairs = PxVehicleDrivableSurfaceToTireFrictionPairs::allocate(MAX_NUM_TIRE_TYPES, MAX_NUM_SURFACE_TYPES);
@@ -227,24 +280,153 @@ void VehicleManager::initialize()
     }
 }
 
-void VehicleManager::updateQueryData(PxScene* scene, unsigned int numWheels)
+VehicleManager::QueryPool* VehicleManager::updateQueryData(PxScene* scene, unsigned int numWheels)
 {
-    if (!_query || _numMaxWheels < numWheels)
+    QueryPool*& pool = _queryPools[scene];
+    if (!pool) pool = new QueryPool;
+    pool->reserve(scene, numWheels, _suspensionSweeps, _sweepHitsPerWheel);
+    return pool;
+}
+
+void VehicleManager::updateInBatches(double step, PxScene* scene, std::vector<PxVehicleWheels*>& vehicles,
+    std::vector<PxVehicleWheelQueryResult>& queryResults)
+{
+    unsigned int size = vehicles.size();
+    unsigned int numBatches = (size + _vehicleBatchSize - 1) / _vehicleBatchSize;
+    VehicleBatchList& batches = _sceneBatches[scene];
+    while (batches.size() < numBatches) batches.push_back(new VehicleBatch);
+    _batchJobs.resize(numBatches);
+
+    for (unsigned int b = 0; b < numBatches; ++b)
+    {
+        VehicleBatch* batch = batches[b];
+        unsigned int start = b * _vehicleBatchSize;
+        batch->numVehicles = std::min(_vehicleBatchSize, size - start);
+        batch->vehicles = &(vehicles[start]);
+        batch->vehicleQueryResults = &(queryResults[start]);
+        batch->surfaceTirePairs = _surfaceTirePairs;
+        batch->gravity = scene->getGravity();
+        batch->step = (PxF32)step;
+
+        unsigned int numWheels = 0;
+        for (unsigned int i = 0; i < batch->numVehicles; ++i)
+            numWheels += batch->vehicles[i]->mWheelsSimData.getNbWheels();
+        batch->prepare(scene, numWheels, _suspensionSweeps, _sweepHitsPerWheel);
+        _batchJobs[b] = batch;
+    }
+
+    // Raycasts and vehicle updates of batches in parallel, and then apply deferred changes to actors
+    _batchTasks.run(scene->getCpuDispatcher(), &(_batchJobs[0]), numBatches);
+
+    // Batches run in parallel, so the slowest one is taken as wall time of each phase
+    double raycastTime = 0.0, updateTime = 0.0;
+    osg::Timer_t postStart = osg::Timer::instance()->tick();
+    for (unsigned int b = 0; b < numBatches; ++b)
+    {
+        VehicleBatch* batch = batches[b];
+        PxVehiclePostUpdates(&(batch->concurrentData[0]), batch->numVehicles, batch->vehicles);
+        raycastTime = std::max(raycastTime, batch->raycastTime);
+        updateTime = std::max(updateTime, batch->updateTime);
+    }
+
+    Profiler* profiler = Profiler::instance();
+    if (profiler->getEnabled())
     {
-        _numMaxWheels = numWheels + 4 * (4 + 6);  // Allocate for another 8 vehicles (4W / 6W) besides current needs
-        _numQueries = numWheels;
-        if (_query) _query->release();
-        if (_queryResults) delete[] _queryResults;
-        if (_queryHitBuffer) delete[] _queryHitBuffer;
+        profiler->addTime(Profiler::VEHICLE_RAYCASTS, raycastTime, scene);
+        profiler->addTime(Profiler::VEHICLE_UPDATES, updateTime +
+                          osg::Timer::instance()->delta_m(postStart, osg::Timer::instance()->tick()), scene);
+    }
+}
+
+/* VehicleManager::QueryPool */
+
+VehicleManager::QueryPool::QueryPool()
+    : scene(NULL), query(NULL), capacity(0), hitsPerWheel(0), sweeps(false)
+{
+}
 
-        _queryResults = new PxRaycastQueryResult[numWheels];
-        _queryHitBuffer = new PxRaycastHit[numWheels];
+VehicleManager::QueryPool::~QueryPool()
+{
+    if (query) query->release();
+}
 
-        PxBatchQueryDesc queryDesc(_numMaxWheels, 0, 0);
-        queryDesc.queryMemory.userRaycastResultBuffer = _queryResults;
-        queryDesc.queryMemory.userRaycastTouchBuffer = _queryHitBuffer;
-        queryDesc.queryMemory.raycastTouchBufferSize = _numQueries;
+void VehicleManager::QueryPool::reserve(PxScene* s, unsigned int numWheels, bool useSweeps, unsigned int hits)
+{
+    if (query && scene == s && numWheels <= capacity && sweeps == useSweeps && (!sweeps || hitsPerWheel == hits))
+        return;
+
+    if (query) query->release();
+    if (scene == s && sweeps == useSweeps)
+        capacity = std::max<unsigned int>(numWheels, capacity * 2);
+    else
+        capacity = std::max<unsigned int>(numWheels, 16);  // Allocate for another 4 cars at least
+    scene = s; sweeps = useSweeps; hitsPerWheel = hits;
+
+    // Result and hit buffers must have the same size as max queries of the batch
+    PxBatchQueryDesc queryDesc(sweeps ? 0 : capacity, sweeps ? capacity : 0, 0);
+    if (sweeps)
+    {
+        sweepResults.resize(capacity);
+        sweepHits.resize(capacity * hitsPerWheel);
+        queryDesc.queryMemory.userSweepResultBuffer = &(sweepResults[0]);
+        queryDesc.queryMemory.userSweepTouchBuffer = &(sweepHits[0]);
+        queryDesc.queryMemory.sweepTouchBufferSize = sweepHits.size();
+        queryDesc.preFilterShader = wheelSweepPreFilter;
+    }
+    else
+    {
+        raycastResults.resize(capacity);
+        raycastHits.resize(capacity);
+        queryDesc.queryMemory.userRaycastResultBuffer = &(raycastResults[0]);
+        queryDesc.queryMemory.userRaycastTouchBuffer = &(raycastHits[0]);
+        queryDesc.queryMemory.raycastTouchBufferSize = raycastHits.size();
         queryDesc.preFilterShader = wheelRaycastPreFilter;
-        _query = scene->createBatchQuery(queryDesc);
     }
+    query = scene->createBatchQuery(queryDesc);
+}
+
+void VehicleManager::QueryPool::execute(unsigned int numVehicles, PxVehicleWheels** vehicles, unsigned int numWheels)
+{
+    if (sweeps)
+        PxVehicleSuspensionSweeps(query, numVehicles, vehicles, (PxU16)numWheels, &(sweepResults[0]), (PxU16)hitsPerWheel);
+    else
+        PxVehicleSuspensionRaycasts(query, numVehicles, vehicles, numWheels, &(raycastResults[0]));
+}
+
+/* VehicleManager::VehicleBatch */
+
+VehicleManager::VehicleBatch::VehicleBatch()
+    : vehicles(NULL), vehicleQueryResults(NULL), surfaceTirePairs(NULL),
+    raycastTime(0.0), updateTime(0.0), step(0.0f), numVehicles(0), numWheels(0)
+{
+}
+
+void VehicleManager::VehicleBatch::prepare(PxScene* s, unsigned int wheels, bool sweeps, unsigned int hitsPerWheel)
+{
+    numWheels = wheels;
+    pool.reserve(s, wheels, sweeps, hitsPerWheel);
+
+    // Deferred actor changes, to be applied by PxVehiclePostUpdates() on the calling thread
+    concurrentData.resize(numVehicles);
+    concurrentWheelData.resize(wheels);
+    for (unsigned int i = 0, w = 0; i < numVehicles; ++i)
+    {
+        PxU32 n = vehicles[i]->mWheelsSimData.getNbWheels();
+        concurrentData[i].concurrentWheelUpdates = &(concurrentWheelData[w]);
+        concurrentData[i].nbConcurrentWheelUpdates = n;
+        w += n;
+    }
+}
+
+void VehicleManager::VehicleBatch::run()
+{
+    osg::Timer* timer = osg::Timer::instance();
+    osg::Timer_t start = timer->tick();
+    pool.execute(numVehicles, vehicles, numWheels);
+
+    osg::Timer_t raycastEnd = timer->tick();
+    PxVehicleUpdates(step, gravity, *surfaceTirePairs, numVehicles, vehicles, vehicleQueryResults,
+                     &(concurrentData[0]));
+    raycastTime = timer->delta_m(start, raycastEnd);
+    updateTime = timer->delta_m(raycastEnd, timer->tick());
 }
@@ -4,12 +4,13 @@
 #include <osg/Referenced>
 #include <osg/Vec3>
 #include "Engine.h"
+#include "TaskGroup.h"
 
 namespace osgPhysics
 {
 
     /** The global vehicle manager */
-    class VehicleManager : public osg::Referenced
+    class VehicleManager : public osg::Referenced, public Engine::SceneObserver
     {
     public:
         static VehicleManager* instance();
@@ -48,7 +49,8 @@ namespace osgPhysics
         static physx::PxFilterData createFilter(FilterType t, physx::PxShape* shape = NULL);
 
         /** Create specified filted scene for vehicles instead of default */
-        static physx::PxScene* createScene(const osg::Vec3& gravity);
+        static physx::PxScene* createScene(const osg::Vec3& gravity, physx::PxSceneFlags flags = physx::PxSceneFlags(),
+                                           unsigned int numThreads = 1, physx::PxCpuDispatcher* dispatcher = 0);
 
         /** Add actor object of specified type to scene for vehicles */
         static bool addActor(const std::string& scene, physx::PxActor* actor, SurfaceType st,
@@ -65,21 +67,93 @@ namespace osgPhysics
         virtual void update(double step, const std::string& scene, std::vector<physx::PxVehicleWheels*>& vehicles,
             std::vector<physx::PxVehicleWheelQueryResult>& queryResults, unsigned int numWheels);
 
+        /** Update car vehicles of specified scene without suspension raycasts, so that they reuse contact planes
+            found by their last raycasts. This is much cheaper and fine for vehicles far away or moving slowly
+        */
+        virtual void updateWithoutRaycasts(double step, const std::string& scene,
+            std::vector<physx::PxVehicleWheels*>& vehicles, std::vector<physx::PxVehicleWheelQueryResult>& queryResults);
+
+        /** Set max number of vehicles in one batch (> 0) to run raycasts and updates of batches in parallel
+            on the scene's CPU dispatcher, each with its own batch query. 0 to update all on the calling thread
+        */
+        void setVehicleBatchSize(unsigned int n) { _vehicleBatchSize = n; }
+        unsigned int getVehicleBatchSize() const { return _vehicleBatchSize; }
+
+        /** Set to use sweeps of wheel shapes instead of raycasts to find suspension contacts, which is more
+            stable when driving over curbs and triangle meshes, with max number of hits of each wheel
+        */
+        void setSuspensionSweeps(bool b, unsigned int hitsPerWheel = 4)
+        { _suspensionSweeps = b; _sweepHitsPerWheel = hitsPerWheel > 0 ? hitsPerWheel : 1; }
+        bool getSuspensionSweeps() const { return _suspensionSweeps; }
+        unsigned int getSweepHitsPerWheel() const { return _sweepHitsPerWheel; }
+
+        /** Release batch queries created for the scene, which is done automatically when the scene is removed
+            from the engine
+        */
+        void releaseQueries(physx::PxScene* scene);
+
+        virtual void sceneRemoved(physx::PxScene* scene) { releaseQueries(scene); }
+
     protected:
         VehicleManager();
         virtual ~VehicleManager();
 
+        /** Batch query and result buffers of a scene, only reallocated when the number of wheels exceeds
+            current capacity, which grows geometrically
+        */
+        struct QueryPool
+        {
+            QueryPool();
+            ~QueryPool();
+            void reserve(physx::PxScene* s, unsigned int numWheels, bool sweeps, unsigned int hitsPerWheel);
+            void execute(unsigned int numVehicles, physx::PxVehicleWheels** vehicles, unsigned int numWheels);
+
+            physx::PxScene* scene;
+            physx::PxBatchQuery* query;
+            std::vector<physx::PxRaycastQueryResult> raycastResults;
+            std::vector<physx::PxRaycastHit> raycastHits;
+            std::vector<physx::PxSweepQueryResult> sweepResults;
+            std::vector<physx::PxSweepHit> sweepHits;
+            unsigned int capacity, hitsPerWheel;
+            bool sweeps;
+        };
+
+        /** Vehicles updated together by one task */
+        struct VehicleBatch : public TaskGroup::Job
+        {
+            VehicleBatch();
+            virtual void run();
+            void prepare(physx::PxScene* s, unsigned int numWheels, bool sweeps, unsigned int hitsPerWheel);
+
+            QueryPool pool;
+            std::vector<physx::PxVehicleConcurrentUpdateData> concurrentData;
+            std::vector<physx::PxVehicleWheelConcurrentUpdateData> concurrentWheelData;
+
+            physx::PxVehicleWheels** vehicles;
+            physx::PxVehicleWheelQueryResult* vehicleQueryResults;
+            physx::PxVehicleDrivableSurfaceToTireFrictionPairs* surfaceTirePairs;
+            double raycastTime, updateTime;  // in milliseconds
+            physx::PxVec3 gravity;
+            physx::PxF32 step;
+            unsigned int numVehicles, numWheels;
+        };
+
         virtual void initialize();
-        virtual void updateQueryData(physx::PxScene* scene, unsigned int numWheels);
+        virtual QueryPool* updateQueryData(physx::PxScene* scene, unsigned int numWheels);
+        virtual void updateInBatches(double step, physx::PxScene* scene, std::vector<physx::PxVehicleWheels*>& vehicles,
+            std::vector<physx::PxVehicleWheelQueryResult>& queryResults);
 
         physx::PxMaterial* _surfaceMaterials[MAX_NUM_SURFACE_TYPES];
         physx::PxVehicleDrivableSurfaceType _surfaceTypes[MAX_NUM_SURFACE_TYPES];
         physx::PxVehicleDrivableSurfaceToTireFrictionPairs* _surfaceTirePairs;
 
-        physx::PxBatchQuery* _query;
-        physx::PxRaycastQueryResult* _queryResults;
-        physx::PxRaycastHit* _queryHitBuffer;
-        physx::PxU32 _numQueries, _numMaxWheels;
+        typedef std::vector<VehicleBatch*> VehicleBatchList;
+        std::map<physx::PxScene*, QueryPool*> _queryPools;
+        std::map<physx::PxScene*, VehicleBatchList> _sceneBatches;
+        std::vector<TaskGroup::Job*> _batchJobs;
+        TaskGroup _batchTasks;
+        unsigned int _vehicleBatchSize, _sweepHitsPerWheel;
+        bool _suspensionSweeps;
     };
 
 }
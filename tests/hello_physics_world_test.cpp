@@ -1,5 +1,6 @@
 #include <physics/PhysicsUtil.h>
 #include <physics/Callbacks.h>
+#include <physics/Profiler.h>
 #include <utils/SceneUtil.h>
 
 #include <osg/ComputeBoundsVisitor>
@@ -15,8 +16,9 @@
 class ShootBoxHandler : public osgGA::GUIEventHandler
 {
 public:
-    ShootBoxHandler(osg::Group* r) : _root(r) {}
+    ShootBoxHandler(osg::Group* r, osgPhysics::UpdatePhysicsSystemCallback* u) : _root(r), _updater(u) {}
     osg::observer_ptr<osg::Group> _root;
+    osg::observer_ptr<osgPhysics::UpdatePhysicsSystemCallback> _updater;
     
     virtual bool handle(const osgGA::GUIEventAdapter& ea, osgGA::GUIActionAdapter& aa)
     {
@@ -28,7 +30,7 @@ public:
         switch (ea.getEventType())
         {
         case osgGA::GUIEventAdapter::KEYUP:
-            if (ea.getKey() == '1' && _root.valid())
+            if (ea.getKey() == '1' && _root.valid() && _updater.valid())
             {
                 physx::PxRigidActor* actor = osgPhysics::createBoxActor(osg::Vec3(1.0f, 1.0f, 1.0f), 5.0);
                 actor->setGlobalPose(physx::PxTransform(osgPhysics::toPxMatrix(
@@ -40,9 +42,11 @@ public:
 
                 osg::ref_ptr<osg::MatrixTransform> mt = dynamic_cast<osg::MatrixTransform*>(
                     osgPhysics::createNodeForActor(actor));
-                mt->addUpdateCallback(new osgPhysics::UpdateActorCallback(actor));
+                _updater->addActorNode(actor, mt.get());
                 _root->addChild(mt.get());
             }
+            else if (ea.getKey() == 'p')
+                osgPhysics::Profiler::instance()->writeCSV("physics_profile.csv");
             break;
         }
         return false;
@@ -80,15 +84,21 @@ int main(int argc, char** argv)
 
             osg::ref_ptr<osg::MatrixTransform> mt = dynamic_cast<osg::MatrixTransform*>(
                 osgPhysics::createNodeForActor(actor));
-            mt->addUpdateCallback(new osgPhysics::UpdateActorCallback(actor));
+            physicsUpdater->addActorNode(actor, mt.get());
             root->addChild(mt.get());
         }
 
+    // Physics timings shown on the stats page, and written to CSV by pressing 'p'
+    osg::ref_ptr<osgViewer::StatsHandler> statsHandler = new osgViewer::StatsHandler;
+    osgPhysics::Profiler::instance()->setEnabled(true);
+    osgPhysics::Profiler::instance()->setStats(viewer.getViewerStats());
+    osgPhysics::Profiler::addStatsLines(statsHandler.get());
+
     // Start the viewer
     viewer.addEventHandler(new osgGA::StateSetManipulator(viewer.getCamera()->getOrCreateStateSet()));
-    viewer.addEventHandler(new osgViewer::StatsHandler);
+    viewer.addEventHandler(statsHandler.get());
     viewer.addEventHandler(new osgViewer::WindowSizeHandler);
-    viewer.addEventHandler(new ShootBoxHandler(root.get()));
+    viewer.addEventHandler(new ShootBoxHandler(root.get(), physicsUpdater.get()));
     viewer.setSceneData(root.get());
     viewer.setUpViewOnSingleScreen(0);
     return viewer.run();
@@ -0,0 +1,66 @@
+#include <physics/PhysicsUtil.h>
+#include <osg/ArgumentParser>
+#include <osg/Timer>
+#include <iostream>
+#include <stdlib.h>
+#include <math.h>
+
+static physx::PxTransform createRandomPose()
+{
+    physx::PxQuat q((float)rand() / RAND_MAX - 0.5f, (float)rand() / RAND_MAX - 0.5f,
+                    (float)rand() / RAND_MAX - 0.5f, (float)rand() / RAND_MAX - 0.5f);
+    physx::PxVec3 p((float)rand() / RAND_MAX * 100.0f, (float)rand() / RAND_MAX * 100.0f,
+                    (float)rand() / RAND_MAX * 100.0f);
+    return physx::PxTransform(p, q.getNormalized());
+}
+
+int main(int argc, char** argv)
+{
+    osg::ArgumentParser arguments(&argc, argv);
+    unsigned int numPoses = 10000, numIterations = 200;
+    arguments.read("--poses", numPoses);
+    arguments.read("--iterations", numIterations);
+    if (!numPoses || !numIterations)
+    {
+        std::cout << "Number of poses and iterations must be positive" << std::endl;
+        return 1;
+    }
+
+    std::vector<physx::PxTransform> poses(numPoses);
+    for (unsigned int i = 0; i < numPoses; ++i) poses[i] = createRandomPose();
+    std::vector<osg::Matrix> results0(numPoses), results1(numPoses);
+
+    // Per-object conversion through PxMat44, as done before batch functions
+    osg::Timer* timer = osg::Timer::instance();
+    osg::Timer_t start = timer->tick();
+    for (unsigned int n = 0; n < numIterations; ++n)
+    {
+        for (unsigned int i = 0; i < numPoses; ++i)
+            results0[i] = osgPhysics::toMatrix(physx::PxMat44(poses[i]));
+    }
+    double singleTime = timer->delta_s(start, timer->tick());
+
+    // Batch conversion
+    start = timer->tick();
+    for (unsigned int n = 0; n < numIterations; ++n)
+        osgPhysics::toMatrices(&poses[0], &results1[0], numPoses);
+    double batchTime = timer->delta_s(start, timer->tick());
+
+    double maxError = 0.0;
+    for (unsigned int i = 0; i < numPoses; ++i)
+    {
+        for (int j = 0; j < 16; ++j)
+        {
+            double e = fabs(results0[i].ptr()[j] - results1[i].ptr()[j]);
+            if (e > maxError) maxError = e;
+        }
+    }
+
+    double total = (double)numPoses * numIterations;
+    std::cout << "Poses: " << numPoses << ", iterations: " << numIterations << std::endl;
+    std::cout << "toMatrix(PxMat44): " << total / singleTime << " matrices/s" << std::endl;
+    std::cout << "toMatrices(): " << total / batchTime << " matrices/s ("
+              << singleTime / batchTime << "x)" << std::endl;
+    std::cout << "Max difference: " << maxError << std::endl;
+    return maxError < 1e-5 ? 0 : 1;
+}
@@ -0,0 +1,340 @@
+#include <physics/PhysicsUtil.h>
+#include <physics/Callbacks.h>
+#include <physics/CharacterController.h>
+#include <physics/Vehicle.h>
+#include <physics/VehicleManager.h>
+#include <physics/Profiler.h>
+#include <physics/CookingCache.h>
+
+#include <osg/ArgumentParser>
+#include <osg/Timer>
+#include <fstream>
+#include <iostream>
+#include <sstream>
+
+#ifdef _WIN32
+#   include <windows.h>
+#   include <psapi.h>
+#   pragma comment(lib, "psapi.lib")
+#else
+#   include <sys/resource.h>
+#endif
+
+#include "terrain_coords.h"
+
+/* Headless benchmark: build a scene with the library helpers, step it for a fixed number of frames
+   without any window, and report throughput, per-phase timings and peak memory as JSON */
+
+struct BenchOptions
+{
+    unsigned int numFrames, numBoxes, numVehicles, numCharacters, numThreads, vehicleBatchSize, characterBatchSize;
+    unsigned int numSnapshots;
+    double timeStep;
+    bool deterministic, lod;
+    std::string output, cookingCache, saveScene, loadScene;
+
+    BenchOptions() : numFrames(1000), numBoxes(1000), numVehicles(20), numCharacters(20), numThreads(2),
+                     vehicleBatchSize(0), characterBatchSize(0), numSnapshots(0), timeStep(1.0 / 60.0),
+                     deterministic(false), lod(false) {}
+};
+
+static double getPeakMemoryMB()
+{
+#ifdef _WIN32
+    PROCESS_MEMORY_COUNTERS counters;
+    if (GetProcessMemoryInfo(GetCurrentProcess(), &counters, sizeof(counters)))
+        return counters.PeakWorkingSetSize / (1024.0 * 1024.0);
+    return 0.0;
+#else
+    struct rusage usage;
+    if (getrusage(RUSAGE_SELF, &usage) == 0)
+#   ifdef __APPLE__
+        return usage.ru_maxrss / (1024.0 * 1024.0);  // in bytes
+#   else
+        return usage.ru_maxrss / 1024.0;  // in kilobytes
+#   endif
+    return 0.0;
+#endif
+}
+
+static void createTerrain(float scale)
+{
+    unsigned int numColumns = 38, numRows = 39;
+    std::vector<float> heightData(numColumns * numRows);
+    for (unsigned int r = 0; r < numRows; ++r)
+        for (unsigned int c = 0; c < numColumns; ++c)
+        {   // Note the coord difference between PhysX and OSG height-fields
+            heightData[r + c * numRows] = vertex[r + c * numRows][2] * 100.0f;
+        }
+
+    physx::PxHeightField* heightField = osgPhysics::createHeightField(numRows, numColumns, &heightData[0]);
+    physx::PxRigidActor* heightFieldActor = osgPhysics::createHeightFieldActor(heightField, scale, scale, 0.1f);
+    osgPhysics::VehicleManager::instance()->addActor(
+        "def", heightFieldActor, osgPhysics::VehicleManager::SURFACE_TARMAC,
+        osgPhysics::VehicleManager::FILTER_GROUND, true);
+}
+
+static void createBoxStacks(unsigned int numBoxes, const osg::Vec3& origin)
+{
+    // Stacks of 10 boxes in a square grid
+    unsigned int numStacks = (numBoxes + 9) / 10, numPerRow = 1;
+    while (numPerRow * numPerRow < numStacks) numPerRow++;
+    for (unsigned int i = 0; i < numBoxes; ++i)
+    {
+        unsigned int stack = i / 10, level = i % 10;
+        osg::Vec3 pos = origin + osg::Vec3(3.0f * (stack % numPerRow), -3.0f * (stack / numPerRow), 1.05f * level);
+        physx::PxRigidActor* actor = osgPhysics::createBoxActor(osg::Vec3(1.0f, 1.0f, 1.0f), 1.0);
+        actor->setGlobalPose(physx::PxTransform(osgPhysics::toPxVec3(pos)));
+        osgPhysics::VehicleManager::instance()->addActor(
+            "def", actor, osgPhysics::VehicleManager::SURFACE_TARMAC,
+            osgPhysics::VehicleManager::FILTER_OBSTACLE, false);
+    }
+}
+
+static osgPhysics::WheeledVehicle* createVehicle(osgPhysics::UpdatePhysicsSystemCallback* physicsUpdater,
+                                                 const osg::Vec3& position)
+{
+    float carMass = 1800.0f, wheelMass = 20.0f;
+    float carWidth = 2.0f, carHeight = 0.5f, carLowerHeight = 0.2f, carLength = 3.0f;
+    float wheelOffsetH = -0.3f, wheelOffsetW = 0.1f, wheelIndent = 0.3f;
+    float wheelRadius = 0.2f, wheelWidth = 0.4f;
+
+    osg::Vec3 wheelOffset[4];
+    wheelOffset[0].set(-(carWidth*0.5f - wheelOffsetW), wheelOffsetH, carLength*0.5f - wheelIndent);  // Front-left
+    wheelOffset[1].set(carWidth*0.5f - wheelOffsetW, wheelOffsetH, carLength*0.5f - wheelIndent);  // Front-right
+    wheelOffset[2].set(-(carWidth*0.5f - wheelOffsetW), wheelOffsetH, -(carLength*0.5f - wheelIndent));  // Rear-left
+    wheelOffset[3].set(carWidth*0.5f - wheelOffsetW, wheelOffsetH, -(carLength*0.5f - wheelIndent));  // Rear-right
+
+    osgPhysics::WheeledVehicle::MotorData motorData;
+    motorData.engine.mPeakTorque = 1000.0f;
+    motorData.engine.mMaxOmega = 1200.0f;
+    motorData.gears.mFinalRatio = 1.0f;
+
+    osgPhysics::WheeledVehicle::ChassisData chassisData;
+    chassisData.mass = carMass;
+    chassisData.mesh = osgPhysics::createBoxMesh(
+        osg::Vec3(0.0f, carHeight*0.5f - carLowerHeight, 0.0f), osg::Vec3(carWidth, carHeight, carLength));
+    chassisData.computeParameters();
+
+    osgPhysics::WheeledVehicle::WheelData wheelData[4];
+    for (int i = 0; i < 4; ++i)
+    {
+        wheelData[i].offset = physx::PxVec3(wheelOffset[i][0], wheelOffset[i][1], wheelOffset[i][2]);
+        wheelData[i].mass = wheelMass;
+        wheelData[i].mesh = osgPhysics::createCylinderMesh(osg::Vec3(), wheelRadius, wheelWidth, 12);
+        wheelData[i].computeParameters(chassisData, i < 2);
+    }
+
+    osgPhysics::CarVehicle* vehicle = new osgPhysics::CarVehicle;
+    vehicle->create(motorData, chassisData, wheelData, NULL, NULL, true);
+    osgPhysics::Engine::instance()->addActor("def", vehicle->getActor());
+    physicsUpdater->addVehicle(vehicle);
+
+    osg::Matrix pose = osg::Matrix::rotate(osg::PI_2, osg::X_AXIS) * osg::Matrix::translate(position);
+    vehicle->resetPose(physx::PxTransform(osgPhysics::toPxMatrix(pose)));
+    vehicle->accelerate(0.6f);
+    return vehicle;
+}
+
+static void writePhase(std::ostream& out, osgPhysics::Profiler::Phase phase, physx::PxScene* scene)
+{
+    osgPhysics::Profiler::PhaseStatistics stats;
+    osgPhysics::Profiler::instance()->getStatistics(phase, stats, scene);
+    out << "\"" << osgPhysics::Profiler::getPhaseName(phase) << "\": {\"min\": " << stats.minimum
+        << ", \"avg\": " << stats.average << ", \"max\": " << stats.maximum << ", \"p99\": " << stats.p99 << "}";
+}
+
+int main(int argc, char** argv)
+{
+    osg::ArgumentParser arguments(&argc, argv);
+    BenchOptions opt;
+    arguments.read("--frames", opt.numFrames);
+    arguments.read("--boxes", opt.numBoxes);
+    arguments.read("--vehicles", opt.numVehicles);
+    arguments.read("--characters", opt.numCharacters);
+    arguments.read("--threads", opt.numThreads);
+    arguments.read("--vehicle-batch", opt.vehicleBatchSize);
+    arguments.read("--character-batch", opt.characterBatchSize);
+    arguments.read("--snapshots", opt.numSnapshots);
+    arguments.read("--step", opt.timeStep);
+    arguments.read("--output", opt.output);
+    if (arguments.read("--deterministic")) opt.deterministic = true;
+    if (arguments.read("--lod")) opt.lod = true;
+    arguments.read("--cooking-cache", opt.cookingCache);
+    arguments.read("--save-scene", opt.saveScene);
+    arguments.read("--load-scene", opt.loadScene);
+    osgPhysics::CookingCache::instance()->setDirectory(opt.cookingCache);
+
+    // The scene and scene updater, which is driven directly with a fixed frame time
+    physx::PxSceneFlags flags;
+    if (opt.deterministic) flags |= physx::PxSceneFlag::eENABLE_ENHANCED_DETERMINISM;
+    osgPhysics::Engine::instance()->addScene(
+        "def", osgPhysics::VehicleManager::createScene(osg::Vec3(0.0f, 0.0f, -9.8f), flags, opt.numThreads));
+    physx::PxScene* scene = osgPhysics::Engine::instance()->getScene("def");
+    osgPhysics::VehicleManager::instance()->setVehicleBatchSize(opt.vehicleBatchSize);
+    osgPhysics::CharacterControlManager::instance()->setLockingEnabled(opt.characterBatchSize > 0);
+    osgPhysics::CharacterControlManager::instance()->setCharacterBatchSize(opt.characterBatchSize);
+
+    osg::ref_ptr<osgPhysics::UpdatePhysicsSystemCallback> physicsUpdater =
+        new osgPhysics::UpdatePhysicsSystemCallback("def");
+    physicsUpdater->setFrameTime(opt.timeStep);
+    if (opt.lod)
+    {
+        // Agents are far from the terrain center, so most of them are simulated in cheaper tiers
+        osg::ref_ptr<osgPhysics::PhysicsLODManager> lodManager = new osgPhysics::PhysicsLODManager;
+        lodManager->setReferencePosition(osg::Vec3d(0.0, 0.0, 40.0));
+        physicsUpdater->setLODManager(lodManager.get());
+    }
+
+    osgPhysics::Profiler* profiler = osgPhysics::Profiler::instance();
+    profiler->setHistorySize(opt.numFrames);
+    profiler->setEnabled(true);
+
+    // Terrain of 380m x 380m, with box stacks, vehicles and characters on it
+    osg::Timer* timer = osg::Timer::instance();
+    osg::Timer_t buildStart = timer->tick();
+    if (!opt.loadScene.empty())
+    {
+        // Terrain and boxes are loaded from a scene saved by --save-scene, while vehicles and characters are not
+        if (!osgPhysics::Engine::instance()->importScene("def", opt.loadScene))
+        {
+            std::cerr << "Failed to load scene " << opt.loadScene << std::endl;
+            return 1;
+        }
+    }
+    else
+    {
+        createTerrain(10.0f);
+        createBoxStacks(opt.numBoxes, osg::Vec3(20.0f, -20.0f, 40.0f));
+        if (!opt.saveScene.empty()) osgPhysics::Engine::instance()->exportScene("def", opt.saveScene);
+    }
+
+    std::vector< osg::ref_ptr<osgPhysics::WheeledVehicle> > vehicles;
+    for (unsigned int i = 0; i < opt.numVehicles; ++i)
+    {
+        osg::Vec3 pos(10.0f + 6.0f * (i % 50), -250.0f - 8.0f * (i / 50), 40.0f);
+        vehicles.push_back(createVehicle(physicsUpdater.get(), pos));
+    }
+
+    std::vector< osg::ref_ptr<osgPhysics::CharacterController> > characters;
+    for (unsigned int i = 0; i < opt.numCharacters; ++i)
+    {
+        osg::Vec3 pos(10.0f + 3.0f * (i % 100), -320.0f - 3.0f * (i / 100), 40.0f);
+        osgPhysics::CharacterController::ControllerData controllerData(1.0f, pos, osg::Z_AXIS);
+        controllerData.stepOffset = 0.2f;
+
+        osg::ref_ptr<osgPhysics::CharacterController> controller = new osgPhysics::CharacterController;
+        if (controller->createCapsule("def", 0.5f, 2.0f, true, controllerData))
+        {
+            physicsUpdater->addCharacter(controller.get());
+            characters.push_back(controller);
+        }
+    }
+    double buildTime = timer->delta_s(buildStart, timer->tick());
+
+    // Optionally capture every frame into the snapshot ring, to measure its cost
+    osgPhysics::Engine* engine = osgPhysics::Engine::instance();
+    double snapshotTime = 0.0, restoreTime = 0.0;
+    if (opt.numSnapshots > 0)
+    {
+        engine->setSnapshotCapacity("def", opt.numSnapshots);
+        for (unsigned int i = 0; i < vehicles.size(); ++i)
+            engine->addSnapshotVehicle("def", vehicles[i]->getDriveEngine());
+    }
+
+    // Step all frames
+    osg::Timer_t start = timer->tick();
+    for (unsigned int f = 0; f < opt.numFrames; ++f)
+    {
+        for (unsigned int i = 0; i < vehicles.size(); ++i)
+        {
+            vehicles[i]->steer((f / 120) % 2 ? 0.3f : -0.3f);
+            vehicles[i]->handleInputs(opt.timeStep);
+        }
+
+        // Characters are moved by the updater all at once
+        for (unsigned int i = 0; i < characters.size(); ++i)
+            characters[i]->move(osg::Vec3(0.05f, 0.0f, 0.0f), 0.01f);
+        (*physicsUpdater)(NULL, NULL);
+
+        if (opt.numSnapshots > 0)
+        {
+            osg::Timer_t snapshotStart = timer->tick();
+            engine->takeSnapshot("def", f);
+            snapshotTime += timer->delta_m(snapshotStart, timer->tick());
+        }
+    }
+    profiler->endFrame();
+    double totalTime = timer->delta_s(start, timer->tick());
+
+    if (opt.numSnapshots > 0 && opt.numFrames >= opt.numSnapshots)
+    {
+        // Rewind to the oldest frame in the ring and then back to the latest, leaving the final state unchanged
+        osg::Timer_t restoreStart = timer->tick();
+        engine->restoreSnapshot("def", opt.numFrames - opt.numSnapshots);
+        engine->restoreSnapshot("def", opt.numFrames - 1);
+        restoreTime = timer->delta_m(restoreStart, timer->tick()) * 0.5;
+    }
+
+    // Sum of all dynamic poses, which should be the same between deterministic runs
+    double checksum = 0.0;
+    physx::PxU32 numDynamics = scene->getNbActors(physx::PxActorTypeFlag::eRIGID_DYNAMIC);
+    std::vector<physx::PxActor*> actors(numDynamics);
+    if (numDynamics > 0) scene->getActors(physx::PxActorTypeFlag::eRIGID_DYNAMIC, &actors[0], numDynamics);
+    for (physx::PxU32 i = 0; i < numDynamics; ++i)
+    {
+        physx::PxTransform t = actors[i]->is<physx::PxRigidDynamic>()->getGlobalPose();
+        checksum += t.p.x + t.p.y + t.p.z + t.q.x + t.q.y + t.q.z + t.q.w;
+    }
+
+    osgPhysics::Profiler::SimulationCounts counts;
+    profiler->getSimulationCounts(scene, counts);
+
+    std::stringstream out;
+    out.precision(10);
+    out << "{" << std::endl
+        << "  \"parameters\": {\"frames\": " << opt.numFrames << ", \"boxes\": " << opt.numBoxes
+        << ", \"vehicles\": " << opt.numVehicles << ", \"characters\": " << characters.size()
+        << ", \"threads\": " << opt.numThreads << ", \"vehicle_batch\": " << opt.vehicleBatchSize
+        << ", \"character_batch\": " << opt.characterBatchSize
+        << ", \"step\": " << opt.timeStep << ", \"deterministic\": " << (opt.deterministic ? "true" : "false")
+        << ", \"load_scene\": " << (opt.loadScene.empty() ? "false" : "true")
+        << ", \"lod\": " << (opt.lod ? "true" : "false")
+        << "}," << std::endl
+        << "  \"build_time_s\": " << buildTime << "," << std::endl
+        << "  \"cooking_cache\": {\"hits\": " << osgPhysics::CookingCache::instance()->getNumHits()
+        << ", \"misses\": " << osgPhysics::CookingCache::instance()->getNumMisses() << "}," << std::endl
+        << "  \"total_time_s\": " << totalTime << "," << std::endl
+        << "  \"steps_per_second\": " << (totalTime > 0.0 ? opt.numFrames / totalTime : 0.0) << "," << std::endl
+        << "  \"peak_memory_mb\": " << getPeakMemoryMB() << "," << std::endl
+        << "  \"checksum\": " << checksum << "," << std::endl
+        << "  \"snapshots\": {\"frames\": " << opt.numSnapshots << ", \"take_ms\": "
+        << (opt.numFrames > 0 ? snapshotTime / opt.numFrames : 0.0) << ", \"restore_ms\": " << restoreTime << "},"
+        << std::endl
+        << "  \"counts\": {\"active_dynamic_bodies\": " << counts.activeDynamicBodies
+        << ", \"static_bodies\": " << counts.staticBodies << ", \"pairs\": " << counts.pairs
+        << ", \"pairs_with_contacts\": " << counts.pairsWithContacts << "}," << std::endl
+        << "  \"phases_ms\": {" << std::endl;
+
+    // Scene-specific phases, and the ones not bound to a scene
+    for (int i = 0; i < osgPhysics::Profiler::NUM_PHASES; ++i)
+    {
+        osgPhysics::Profiler::Phase phase = (osgPhysics::Profiler::Phase)i;
+        out << "    ";
+        writePhase(out, phase, phase == osgPhysics::Profiler::TRANSFORM_SYNC ? NULL : scene);
+        out << (i + 1 < osgPhysics::Profiler::NUM_PHASES ? "," : "") << std::endl;
+    }
+    out << "  }" << std::endl << "}" << std::endl;
+
+    if (opt.output.empty()) std::cout << out.str();
+    else
+    {
+        std::ofstream file(opt.output.c_str());
+        file << out.str();
+    }
+
+    characters.clear();
+    vehicles.clear();
+    osgPhysics::Engine::instance()->clear();
+    return 0;
+}
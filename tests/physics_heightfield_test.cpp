@@ -1,5 +1,6 @@
 #include <physics/PhysicsUtil.h>
 #include <physics/Callbacks.h>
+#include <physics/ActorPool.h>
 #include <utils/SceneUtil.h>
 
 #include <osg/ComputeBoundsVisitor>
@@ -12,12 +13,14 @@
 #include <osgViewer/ViewerEventHandlers>
 #include <osgViewer/Viewer>
 #include "terrain_coords.h"
+#include <deque>
 
 class ShootBoxHandler : public osgGA::GUIEventHandler
 {
 public:
-    ShootBoxHandler(osg::Group* r) : _root(r) {}
-    osg::observer_ptr<osg::Group> _root;
+    ShootBoxHandler(osgPhysics::ActorPool* p) : _pool(p) {}
+    osg::ref_ptr<osgPhysics::ActorPool> _pool;
+    std::deque<physx::PxRigidActor*> _boxes;
     
     virtual bool handle(const osgGA::GUIEventAdapter& ea, osgGA::GUIActionAdapter& aa)
     {
@@ -29,20 +32,20 @@ public:
         switch (ea.getEventType())
         {
         case osgGA::GUIEventAdapter::KEYUP:
-            if (ea.getKey() == '1' && _root.valid())
+            if (ea.getKey() == '1')
             {
-                physx::PxRigidActor* actor = osgPhysics::createBoxActor(osg::Vec3(1.0f, 1.0f, 1.0f), 5.0);
-                actor->setGlobalPose(physx::PxTransform(osgPhysics::toPxMatrix(
-                    osg::Matrix::translate(start))));
-                
-                physx::PxRigidDynamic* dynActor = actor->is<physx::PxRigidDynamic>();
-                dynActor->setLinearVelocity(physx::PxVec3(target[0], target[1], target[2]));
-                osgPhysics::Engine::instance()->addActor("def", actor);
+                // Recycle the oldest box when too many are shot
+                if (_boxes.size() >= 64)
+                { _pool->release(_boxes.front()); _boxes.pop_front(); }
 
-                osg::ref_ptr<osg::MatrixTransform> mt = dynamic_cast<osg::MatrixTransform*>(
-                    osgPhysics::createNodeForActor(actor));
-                mt->addUpdateCallback(new osgPhysics::UpdateActorCallback(actor));
-                _root->addChild(mt.get());
+                physx::PxRigidDynamic* dynActor = _pool->acquire(
+                    physx::PxBoxGeometry(0.5f, 0.5f, 0.5f), 5.0, NULL,
+                    physx::PxTransform(osgPhysics::toPxMatrix(osg::Matrix::translate(start))));
+                if (dynActor)
+                {
+                    dynActor->setLinearVelocity(physx::PxVec3(target[0], target[1], target[2]));
+                    _boxes.push_back(dynActor);
+                }
             }
             break;
         }
@@ -86,11 +89,17 @@ int main(int argc, char** argv)
     osg::ref_ptr<osg::Node> groundNode = osgPhysics::createNodeForActor(heightFieldActor);
     root->addChild(groundNode.get());
 
+    // Boxes to shoot are pre-created and recycled
+    osg::ref_ptr<osgPhysics::ActorPool> boxPool = new osgPhysics::ActorPool("def");
+    boxPool->setSystemUpdater(physicsUpdater.get());
+    boxPool->reserve(physx::PxBoxGeometry(0.5f, 0.5f, 0.5f), 5.0, NULL, 64);
+    root->addChild(boxPool->getRoot());
+
     // Start the viewer
     viewer.addEventHandler(new osgGA::StateSetManipulator(viewer.getCamera()->getOrCreateStateSet()));
     viewer.addEventHandler(new osgViewer::StatsHandler);
     viewer.addEventHandler(new osgViewer::WindowSizeHandler);
-    viewer.addEventHandler(new ShootBoxHandler(root.get()));
+    viewer.addEventHandler(new ShootBoxHandler(boxPool.get()));
     viewer.setSceneData(root.get());
     viewer.setUpViewOnSingleScreen(0);
     
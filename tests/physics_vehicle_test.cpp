@@ -1,6 +1,7 @@
 #include <physics/Vehicle.h>
 #include <physics/PhysicsUtil.h>
 #include <physics/ParticleUpdater.h>
+#include <physics/ParticleGeometry.h>
 #include <physics/Callbacks.h>
 #include <utils/InputManager.h>
 #include <utils/FollowNodeManipulator.h>
@@ -242,6 +243,72 @@ osgParticle::ParticleSystem* createParticleSystem(osg::Group* parent)
     parent->addChild(geode.get());
     return ps.get();
 }
+
+/** Emit PhysX particles every frame without osgParticle, which are drawn by osgPhysics::ParticleGeometry */
+class EmitParticlesCallback : public osg::NodeCallback
+{
+public:
+    EmitParticlesCallback(osgPhysics::ParticleUpdater* pu, const osg::Vec3& origin, unsigned int numPerFrame)
+        : _updater(pu), _origin(origin), _numPerFrame(numPerFrame) {}
+
+    virtual void operator()(osg::Node* node, osg::NodeVisitor* nv)
+    {
+        // Indices are left empty to be allocated by the updater
+        _particles.positions.resize(_numPerFrame);
+        _particles.velocities.resize(_numPerFrame);
+        for (unsigned int i = 0; i < _numPerFrame; ++i)
+        {
+            osg::Vec3 dir(random(-1.0f, 1.0f), random(-1.0f, 1.0f), random(2.0f, 4.0f));
+            _particles.positions[i] = osgPhysics::toPxVec3(_origin + dir * 0.1f);
+            _particles.velocities[i] = osgPhysics::toPxVec3(dir);
+        }
+        _particles.numParticles = _numPerFrame;
+        _particles.lifeTime = 3.0f;
+        _updater->generate(_particles);
+        traverse(node, nv);
+    }
+
+protected:
+    static float random(float min, float max) { return min + (max - min) * (float)rand() / (float)RAND_MAX; }
+
+    osg::ref_ptr<osgPhysics::ParticleUpdater> _updater;
+    osgPhysics::ParticleUpdater::ParticleData _particles;
+    osg::Vec3 _origin;
+    unsigned int _numPerFrame;
+};
+
+osgPhysics::ParticleGeometry* createParticleGeometry(osg::Group* parent, const osg::Vec3& origin)
+{
+    osgPhysics::ParticleUpdater::ParticleAttributes attributes;
+    osg::ref_ptr<osgPhysics::ParticleUpdater> physicsParticleUpdater = new osgPhysics::ParticleUpdater;
+    physicsParticleUpdater->create(attributes);
+
+    osgPhysics::VehicleManager::SurfaceType surface = osgPhysics::VehicleManager::SURFACE_TARMAC;
+    osgPhysics::VehicleManager::FilterType filter = osgPhysics::VehicleManager::FILTER_OBSTACLE;
+    osgPhysics::VehicleManager::instance()->addActor(
+        "def", physicsParticleUpdater->getActor(), surface, filter, false);
+
+    // Particles are written into the geometry directly, in world coordinates
+    osg::ref_ptr<osgPhysics::ParticleGeometry> geom = new osgPhysics::ParticleGeometry(physicsParticleUpdater.get());
+    geom->setPointSize(20.0f);
+
+    osg::ref_ptr<osg::BlendFunc> blendFunc = new osg::BlendFunc;
+    blendFunc->setFunction(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
+
+    osg::ref_ptr<osg::Texture2D> texture = new osg::Texture2D;
+    texture->setImage(osgDB::readImageFile("Images/smoke.rgb"));
+
+    osg::StateSet* ss = geom->getOrCreateStateSet();
+    ss->setAttributeAndModes(blendFunc.get());
+    ss->setTextureAttributeAndModes(0, texture.get());
+    ss->setRenderingHint(osg::StateSet::TRANSPARENT_BIN);
+
+    osg::ref_ptr<osg::Geode> geode = new osg::Geode;
+    geode->addDrawable(geom.get());
+    geode->addUpdateCallback(new EmitParticlesCallback(physicsParticleUpdater.get(), origin, 10));
+    parent->addChild(geode.get());
+    return geom.get();
+}
 #endif
 
 int main(int argc, char** argv)
@@ -292,9 +359,18 @@ int main(int argc, char** argv)
     particleGroup->setMatrix(osg::Matrix::translate(initialPosition + osg::Z_AXIS * 5.0f));
 
 #if !(PX_PHYSICS_VERSION_MAJOR > 3)
-    osgParticle::ParticleSystem* ps = createParticleSystem(particleGroup.get());
     osg::ref_ptr<osgParticle::ParticleSystemUpdater> particleUpdater = new osgParticle::ParticleSystemUpdater;
-    particleUpdater->addParticleSystem(ps);
+    if (arguments.read("--direct-particles"))
+    {
+        // Draw particles without osgParticle, which are in world coordinates
+        particleGroup->setMatrix(osg::Matrix());
+        createParticleGeometry(particleGroup.get(), initialPosition + osg::Z_AXIS * 5.0f);
+    }
+    else
+    {
+        osgParticle::ParticleSystem* ps = createParticleSystem(particleGroup.get());
+        particleUpdater->addParticleSystem(ps);
+    }
 #endif
 
     // Build the scene graph